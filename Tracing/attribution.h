@@ -0,0 +1,278 @@
+//attribution.h 按物体与材质统计渲染开销
+#ifndef ATTRIBUTION_H
+#define ATTRIBUTION_H
+
+#include "hittable.h"
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+// Readable class name from typeid, for default names.
+inline std::string type_label(const std::type_info &type)
+{
+    std::string name = type.name();
+    if (name.compare(0, 6, "class ") == 0)
+        return name.substr(6);
+    size_t digits = 0;
+    while (digits < name.size() && name[digits] >= '0' && name[digits] <= '9')
+        digits++;
+    return name.substr(digits);
+}
+
+// Render cost split by named scene object and by material. Intersection cost
+// is the time spent in the hit() of each tagged object, inclusive of
+// everything below it; shading cost is the time spent in a material's
+// emitted() and scatter(), textures included. Every call is counted, and one
+// call in sample_period is timed. The counts and sampled times go into
+// per-thread blocks, which report() sums once the render threads have been
+// joined. With TRACING_STATS, tagged objects also get the exact BVH nodes and
+// primitives they visited.
+class cost_attribution
+{
+public:
+    struct counters
+    {
+        long long calls = 0;
+        long long hits = 0;
+        long long timed = 0;
+        double timed_ns = 0;
+        long long nodes = 0;
+        long long prims = 0;
+
+        // Estimated total time, scaling the timed calls up to all calls.
+        double estimated_ms() const { return timed ? timed_ns * calls / timed / 1e6 : 0; }
+    };
+
+    struct thread_block
+    {
+        std::vector<counters> objects;   // by tag slot
+        std::vector<counters> materials; // by material::id
+        unsigned tick = 0;
+
+        bool sample()
+        {
+            return ++tick % instance().sample_period == 0;
+        }
+    };
+
+    static cost_attribution &instance()
+    {
+        static cost_attribution a;
+        return a;
+    }
+
+    int add_object(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        object_names.push_back(name);
+        return int(object_names.size()) - 1;
+    }
+
+    // Later names replace earlier ones unless only_if_unnamed.
+    void name_material(int id, const std::string &name, bool only_if_unnamed = false)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!only_if_unnamed || !material_names.count(id))
+            material_names[id] = name;
+    }
+
+    // The calling thread's block, grown to cover slot and material id.
+    thread_block &local(int object_slot, int material_id)
+    {
+        thread_local thread_block *block = register_thread();
+        if (object_slot >= int(block->objects.size()))
+            block->objects.resize(object_slot + 1);
+        if (material_id >= int(block->materials.size()))
+            block->materials.resize(material_id + 1);
+        return *block;
+    }
+
+    // Ranked tables of the objects and materials, most expensive first.
+    void report(std::ostream &out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<counters> objects(object_names.size()), materials;
+        for (const auto &b : blocks)
+        {
+            if (b->materials.size() > materials.size())
+                materials.resize(b->materials.size());
+            for (size_t k = 0; k < b->objects.size() && k < objects.size(); k++)
+                add(objects[k], b->objects[k]);
+            for (size_t k = 0; k < b->materials.size(); k++)
+                add(materials[k], b->materials[k]);
+        }
+
+        std::vector<std::string> names;
+        for (size_t k = 0; k < materials.size(); k++)
+        {
+            auto it = material_names.find(int(k));
+            names.push_back(it != material_names.end() ? it->second : "");
+        }
+
+        out << "Intersection cost by object (hit() time, inclusive)\n";
+        table(out, object_names, objects, true);
+        out << "Shading cost by material (emitted() + scatter() time)\n";
+        table(out, names, materials, false);
+    }
+
+    bool enabled = false;
+    unsigned sample_period = 8;
+
+private:
+    thread_block *register_thread()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        blocks.emplace_back(new thread_block);
+        return blocks.back().get();
+    }
+
+    static void add(counters &sum, const counters &c)
+    {
+        sum.calls += c.calls;
+        sum.hits += c.hits;
+        sum.timed += c.timed;
+        sum.timed_ns += c.timed_ns;
+        sum.nodes += c.nodes;
+        sum.prims += c.prims;
+    }
+
+    static void table(std::ostream &out, const std::vector<std::string> &names,
+                      const std::vector<counters> &rows, bool objects)
+    {
+        std::vector<size_t> order;
+        double total = 0;
+        for (size_t k = 0; k < rows.size(); k++)
+            if (rows[k].calls)
+            {
+                order.push_back(k);
+                total += rows[k].estimated_ms();
+            }
+        std::sort(order.begin(), order.end(),
+                  [&](size_t a, size_t b) { return rows[a].estimated_ms() > rows[b].estimated_ms(); });
+
+        for (auto k : order)
+        {
+            const auto &r = rows[k];
+            const auto &name = names[k];
+            out << "  " << name << std::string(name.size() < 28 ? 28 - name.size() : 1, ' ') << r.estimated_ms()
+                << " ms  " << (total > 0 ? 100 * r.estimated_ms() / total : 0) << "%  " << r.calls
+                << (objects ? " tests, " : " shades");
+            if (objects)
+            {
+                out << r.hits << " hits";
+#ifdef TRACING_STATS
+                out << ", " << r.nodes << " nodes, " << r.prims << " prims";
+#endif
+            }
+            out << "\n";
+        }
+    }
+
+    std::mutex mutex;
+    std::vector<std::string> object_names;
+    std::map<int, std::string> material_names;
+    std::vector<std::unique_ptr<thread_block>> blocks;
+};
+
+// A named scene object whose intersection cost is attributed to its name
+// while cost_attribution is enabled; otherwise it forwards hit() unchanged.
+// flatten_scene keeps tags on top-level objects.
+class tagged : public hittable
+{
+public:
+    tagged(const std::string &n, shared_ptr<hittable> p)
+        : name(n), object(p), slot(cost_attribution::instance().add_object(n)) {}
+
+    virtual bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const
+    {
+        auto &attribution = cost_attribution::instance();
+        if (!attribution.enabled)
+            return object->hit(r, t_min, t_max, rec);
+
+        // Nested tags may grow the block during the hit, so index it afterwards.
+        auto &block = attribution.local(slot, 0);
+        bool timed = block.sample();
+        STAT(auto nodes = thread_stats().bvh_nodes_visited; auto prims = thread_stats().primitives_tested());
+        auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        bool hit_anything = object->hit(r, t_min, t_max, rec);
+
+        auto &c = block.objects[slot];
+        if (timed)
+        {
+            c.timed_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            c.timed++;
+        }
+        c.calls++;
+        c.hits += hit_anything;
+        STAT(c.nodes += thread_stats().bvh_nodes_visited - nodes; c.prims += thread_stats().primitives_tested() - prims);
+        return hit_anything;
+    }
+
+    virtual bool bounding_box(double t0, double t1, aabb &output_box) const
+    {
+        return object->bounding_box(t0, t1, output_box);
+    }
+
+public:
+    std::string name;
+    shared_ptr<hittable> object;
+    int slot;
+};
+
+// Times one material's shading work when attribution is enabled. Unnamed
+// materials are reported by class name and id.
+template <typename M>
+class shading_scope
+{
+public:
+    explicit shading_scope(const M &m) : id(m.id)
+    {
+        auto &attribution = cost_attribution::instance();
+        if (!attribution.enabled)
+            return;
+        block = &attribution.local(0, id);
+        if (block->materials[id].calls++ == 0)
+            attribution.name_material(id, type_label(typeid(m)) + " " + std::to_string(id), true);
+        timing = block->sample();
+        if (timing)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ~shading_scope()
+    {
+        if (timing)
+        {
+            auto &c = block->materials[id];
+            c.timed_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            c.timed++;
+        }
+    }
+
+private:
+    int id;
+    cost_attribution::thread_block *block = nullptr;
+    bool timing = false;
+    std::chrono::steady_clock::time_point start;
+};
+
+inline shared_ptr<tagged> tag(const std::string &name, shared_ptr<hittable> object)
+{
+    return make_shared<tagged>(name, object);
+}
+
+// Names a material in the attribution report and returns it.
+template <typename M>
+shared_ptr<M> named(const std::string &name, shared_ptr<M> m)
+{
+    cost_attribution::instance().name_material(m->id, name);
+    return m;
+}
+
+#endif
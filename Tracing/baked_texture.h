@@ -0,0 +1,56 @@
+//baked_texture.h 程序纹理烘焙
+#ifndef BAKED_TEXTURE_H
+#define BAKED_TEXTURE_H
+
+#include "parallel.h"
+#include "texture.h"
+#include "timeline.h"
+#include <functional>
+
+// A procedural texture evaluated once at scene load over a surface's uv domain
+// (rows baked in parallel) and stored as a mip-mapped image_texture, so
+// lookups become filtered image reads. A footprint smaller than a baked texel
+// asks for more detail than the bake holds; those lookups evaluate the source
+// exactly instead.
+class baked_texture : public texture
+{
+public:
+    // surface_point maps uv to the world position the source is evaluated at.
+    baked_texture(shared_ptr<texture> src, int A, int B, std::function<vec3(double, double)> surface_point)
+        : source(src)
+    {
+        timeline_scope scope("bake texture", "load");
+        std::vector<float> texels(size_t(3) * A * B);
+        parallel_for(0, B, [&](int j) {
+            for (int i = 0; i < A; i++)
+            {
+                auto u = (i + 0.5) / A;
+                auto v = 1 - (j + 0.5) / B;
+                auto c = src->value(u, v, surface_point(u, v));
+                float *t = &texels[size_t(3) * (size_t(A) * j + i)];
+                t[0] = float(c.x());
+                t[1] = float(c.y());
+                t[2] = float(c.z());
+            }
+        });
+        baked = make_shared<image_texture>(std::move(texels), A, B);
+    }
+
+    virtual vec3 value(double u, double v, const vec3 &p) const
+    {
+        return baked->value(u, v, p);
+    }
+
+    virtual vec3 filtered_value(double u, double v, const vec3 &p, double du, double dv) const
+    {
+        if (du * baked->nx < 1 && dv * baked->ny < 1)
+            return source->value(u, v, p);
+        return baked->filtered_value(u, v, p, du, dv);
+    }
+
+public:
+    shared_ptr<texture> source;
+    shared_ptr<image_texture> baked;
+};
+
+#endif
@@ -0,0 +1,233 @@
+//benchmark.cpp 内核微基准
+// Standalone microbenchmarks for the tracing kernels. Build next to
+// tracing.cpp as its own executable:
+//     g++ -std=c++17 -O2 benchmark.cpp -o benchmark -pthread
+// Usage: benchmark [--filter substring] [--json path] [--samples N]
+#include "rtweekend.h"
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#define STB_DXT_IMPLEMENTATION
+#include "bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "texture.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct bench_result
+{
+    string name;
+    bool per_ray;       // a ray query, reported as Mrays/s as well
+    double median_ns;   // per call
+    double min_ns;
+    double mean_ns;
+    double stddev_ns;
+    long long calls;    // per sample
+    int samples;
+};
+
+// Runs body(k) for k = 0, 1, ... in batches sized to take about 10 ms, and
+// summarises the per-call time over the samples. body returns a value that is
+// accumulated so the compiler cannot drop the work.
+class bench_runner
+{
+public:
+    template <typename F>
+    void run(const string &name, bool per_ray, F body)
+    {
+        if (!filter.empty() && name.find(filter) == string::npos)
+            return;
+
+        long long calls = 1;
+        for (;;)
+        {
+            auto seconds = time_batch(body, calls);
+            if (seconds > 0.01 || calls >= (1ll << 30))
+                break;
+            calls *= 2;
+        }
+
+        vector<double> ns(samples);
+        for (auto &t : ns)
+            t = time_batch(body, calls) * 1e9 / calls;
+        sort(ns.begin(), ns.end());
+
+        bench_result r = {name, per_ray, ns[samples / 2], ns[0], 0, 0, calls, samples};
+        for (auto t : ns)
+            r.mean_ns += t / samples;
+        for (auto t : ns)
+            r.stddev_ns += (t - r.mean_ns) * (t - r.mean_ns) / max(samples - 1, 1);
+        r.stddev_ns = sqrt(r.stddev_ns);
+        results.push_back(r);
+
+        cout << name << string(name.size() < 34 ? 34 - name.size() : 1, ' ') << r.median_ns << " ns";
+        if (per_ray)
+            cout << "  " << 1e3 / r.median_ns << " Mrays/s";
+        cout << "  (+-" << r.stddev_ns << ", min " << r.min_ns << ")\n";
+    }
+
+    void write_json(ostream &out) const
+    {
+        out << "{\n  \"benchmarks\": [\n";
+        for (size_t k = 0; k < results.size(); k++)
+        {
+            const auto &r = results[k];
+            out << "    {\"name\": \"" << r.name << "\", \"median_ns\": " << r.median_ns
+                << ", \"min_ns\": " << r.min_ns << ", \"mean_ns\": " << r.mean_ns
+                << ", \"stddev_ns\": " << r.stddev_ns << ", \"calls_per_sample\": " << r.calls
+                << ", \"samples\": " << r.samples;
+            if (r.per_ray)
+                out << ", \"mrays_per_s\": " << 1e3 / r.median_ns;
+            out << "}" << (k + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+
+    string filter;
+    int samples = 15;
+    vector<bench_result> results;
+
+private:
+    volatile double sink = 0;
+
+    template <typename F>
+    double time_batch(F &body, long long calls)
+    {
+        auto start = chrono::steady_clock::now();
+        double sum = 0;
+        for (long long k = 0; k < calls; k++)
+            sum += body(k);
+        sink = sink + sum;
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+};
+
+// Rays from a shell around the origin towards random points near it, so that
+// roughly half of them hit an object of radius ~1 at the origin.
+vector<ray> make_rays(size_t count, double spread)
+{
+    vector<ray> rays(count);
+    for (auto &r : rays)
+    {
+        auto origin = 5 * random_unit_vector();
+        auto target = vec3::random(-spread, spread);
+        r = ray(origin, target - origin, random_double());
+    }
+    return rays;
+}
+
+int main(int argc, char **argv)
+{
+    bench_runner bench;
+    string json_path;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (!strcmp(argv[a], "--filter") && a + 1 < argc)
+            bench.filter = argv[++a];
+        else if (!strcmp(argv[a], "--json") && a + 1 < argc)
+            json_path = argv[++a];
+        else if (!strcmp(argv[a], "--samples") && a + 1 < argc)
+            bench.samples = max(atoi(argv[++a]), 1);
+    }
+
+    // Fixed seeds: random_double() on the main thread and rand() in bvh_node.
+    srand(1);
+    const size_t mask = (1 << 12) - 1;
+    auto rays = make_rays(mask + 1, 1.5);
+    auto bvh_rays = make_rays(mask + 1, 6);
+    hit_record rec;
+
+    auto gray = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.5, 0.5, 0.5)));
+
+    // Geometry
+    aabb unit_box(vec3(-1, -1, -1), vec3(1, 1, 1));
+    bench.run("aabb::hit", true, [&](long long k) { return unit_box.hit(rays[k & mask], 0.001, infinity); });
+
+    sphere ball(vec3(0, 0, 0), 1, gray);
+    bench.run("sphere::hit", true, [&](long long k) { return ball.hit(rays[k & mask], 0.001, infinity, rec); });
+
+    moving_sphere mover(vec3(-0.5, 0, 0), vec3(0.5, 0, 0), 0, 1, 1, gray);
+    bench.run("moving_sphere::hit", true, [&](long long k) { return mover.hit(rays[k & mask], 0.001, infinity, rec); });
+
+    xy_rect xy(-1, 1, -1, 1, 0, gray);
+    xz_rect xz(-1, 1, -1, 1, 0, gray);
+    yz_rect yz(-1, 1, -1, 1, 0, gray);
+    bench.run("xy_rect::hit", true, [&](long long k) { return xy.hit(rays[k & mask], 0.001, infinity, rec); });
+    bench.run("xz_rect::hit", true, [&](long long k) { return xz.hit(rays[k & mask], 0.001, infinity, rec); });
+    bench.run("yz_rect::hit", true, [&](long long k) { return yz.hit(rays[k & mask], 0.001, infinity, rec); });
+
+    box cube(vec3(-1, -1, -1), vec3(1, 1, 1), gray);
+    bench.run("box::hit", true, [&](long long k) { return cube.hit(rays[k & mask], 0.001, infinity, rec); });
+
+    for (int count = 10; count <= 100000; count *= 10)
+    {
+        // Spheres in a cube of side 10, at the same total volume for every count.
+        hittable_list spheres;
+        auto radius = 2 / cbrt(double(count));
+        for (int s = 0; s < count; s++)
+            spheres.add(make_shared<sphere>(vec3::random(-5, 5), radius, gray));
+        bvh_node tree(spheres, 0, 1);
+        bench.run("bvh_node::hit/" + to_string(count), true,
+                  [&](long long k) { return tree.hit(bvh_rays[k & mask], 0.001, infinity, rec); });
+    }
+
+    // Materials, scattering from a fixed hit on the unit sphere.
+    ball.hit(ray(vec3(0, 0, 5), vec3(0.1, 0.2, -1)), 0.001, infinity, rec);
+    ray incoming(vec3(0, 0, 5), vec3(0.1, 0.2, -1));
+    vec3 attenuation;
+    ray scattered;
+    auto checker = make_shared<checker_texture>(make_shared<constant_texture>(vec3(0.2, 0.3, 0.1)),
+                                                make_shared<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    shared_ptr<material> materials[] = {gray, make_shared<lambertian>(checker), make_shared<metal>(vec3(0.8, 0.8, 0.9), 0.3),
+                                        make_shared<dielectric>(1.5), make_shared<diffuse_light>(checker),
+                                        make_shared<isotropic>(checker)};
+    const char *material_names[] = {"lambertian(constant)", "lambertian(checker)", "metal", "dielectric",
+                                    "diffuse_light", "isotropic"};
+    for (int m = 0; m < 6; m++)
+        bench.run(string("scatter/") + material_names[m], false, [&](long long k) {
+            return materials[m]->scatter(incoming, rec, attenuation, scattered) + attenuation.x();
+        });
+
+    // Textures
+    vector<vec3> points(mask + 1);
+    for (auto &p : points)
+        p = vec3::random(-100, 100);
+    perlin noise;
+    bench.run("perlin::turb", false, [&](long long k) { return noise.turb(points[k & mask]); });
+    bench.run("perlin::noise", false, [&](long long k) { return noise.noise(points[k & mask]); });
+
+    // A synthetic 1024x512 image so the benchmark does not depend on files.
+    vector<float> texels(size_t(3) * 1024 * 512);
+    for (auto &t : texels)
+        t = float(random_double());
+    image_texture image(texels, 1024, 512);
+    bench.run("image_texture::value", false, [&](long long k) {
+        const auto &p = points[k & mask];
+        return image.value(p.x() / 200 + 0.5, p.y() / 200 + 0.5, p).x();
+    });
+    bench.run("image_texture::filtered_value", false, [&](long long k) {
+        const auto &p = points[k & mask];
+        return image.filtered_value(p.x() / 200 + 0.5, p.y() / 200 + 0.5, p, 0.01, 0.01).x();
+    });
+
+    // Sampling
+    vec3 normal(0, 0, 1);
+    bench.run("random_double", false, [&](long long) { return random_double(); });
+    bench.run("random_unit_vector", false, [&](long long) { return random_unit_vector().x(); });
+    bench.run("random_in_unit_sphere", false, [&](long long) { return random_in_unit_sphere().x(); });
+    bench.run("random_in_hemisphere", false, [&](long long) { return random_in_hemisphere(normal).x(); });
+    bench.run("random_in_unit_disk", false, [&](long long) { return random_in_unit_disk().x(); });
+
+    if (!json_path.empty())
+    {
+        ofstream out(json_path);
+        bench.write_json(out);
+    }
+}
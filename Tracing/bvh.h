@@ -58,7 +58,7 @@ bvh_node::bvh_node(
     std::vector<shared_ptr<hittable>> &objects,
     size_t start, size_t end, double time0, double time1)
 {
-    int axis = (int)(rand() * 2.99);
+    int axis = rand() % 3;
     auto comparator = (axis == 0)   ? box_x_compare
                       : (axis == 1) ? box_y_compare
                                     : box_z_compare;
@@ -101,6 +101,7 @@ bvh_node::bvh_node(
 
 bool bvh_node::hit(const ray &r, double t_min, double t_max, hit_record &rec) const
 {
+    STAT(thread_stats().bvh_nodes_visited++);
     if (!box.hit(r, t_min, t_max))
         return false;
 
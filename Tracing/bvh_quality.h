@@ -0,0 +1,185 @@
+//bvh_quality.h BVH 质量分析
+#ifndef BVH_QUALITY_H
+#define BVH_QUALITY_H
+
+#include "bvh.h"
+#include <ostream>
+#include <typeinfo>
+#include <vector>
+
+// Quality metrics of a built bvh_node tree. Every child that is not itself a
+// bvh_node counts as one primitive (a box or an instance is one primitive
+// here, however much it holds). Surface-area probabilities assume rays
+// uniformly distributed over the lines that cross the root box.
+struct bvh_quality
+{
+    int nodes = 0;
+    int primitives = 0;        // primitive references, duplicates included
+    int duplicated_leaves = 0; // nodes with left == right
+    int flat_nodes = 0;        // node boxes with no volume
+    int stalled_splits = 0;    // a child box equals the node box
+    int max_depth = 0;
+    std::vector<int> depth_histogram; // primitive references by depth (root children at 1)
+    int leaf_sizes[3] = {};           // nodes by number of primitive children
+    double overlap = 0;               // sum of SA(left & right) / SA(root)
+    double overlap_ratio = 0;         // overlap relative to all child area
+    double expected_nodes = 0;        // nodes entered per ray entering the root
+    double expected_prims = 0;        // primitives tested per ray entering the root
+
+    // SAH cost with the given traversal and intersection costs. A primitive is
+    // tested whenever its parent node is entered, so this is a weighted sum of
+    // the expected visits.
+    double sah_cost(double traversal = 1, double intersection = 1) const
+    {
+        return traversal * expected_nodes + intersection * expected_prims;
+    }
+
+    static bvh_quality analyze(const bvh_node &root)
+    {
+        bvh_quality q;
+        q.root_area = area(root.box);
+        q.walk(root, 0);
+        q.overlap_ratio = q.child_area > 0 ? q.overlap / q.child_area : 0;
+        return q;
+    }
+
+    void report(std::ostream &out) const
+    {
+        out << "  nodes " << nodes << ", primitive references " << primitives << ", max depth " << max_depth
+            << "\n  SAH cost " << sah_cost() << " (expected per ray: " << expected_nodes << " nodes, "
+            << expected_prims << " primitives)\n  sibling overlap " << overlap_ratio * 100
+            << "% of child area\n  leaf sizes: " << leaf_sizes[0] << " inner, " << leaf_sizes[1]
+            << " with one primitive, " << leaf_sizes[2] << " with two\n  degenerate: " << duplicated_leaves
+            << " left==right leaves, " << flat_nodes << " flat boxes, " << stalled_splits << " stalled splits\n"
+            << "  depth histogram:";
+        for (size_t d = 0; d < depth_histogram.size(); d++)
+            if (depth_histogram[d])
+                out << ' ' << d << ':' << depth_histogram[d];
+        out << '\n';
+    }
+
+private:
+    double root_area = 0;
+    double child_area = 0;
+
+    static double area(const aabb &b)
+    {
+        auto d = b.max() - b.min();
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    static bool same_box(const aabb &a, const aabb &b)
+    {
+        for (int k = 0; k < 3; k++)
+            if (a.min()[k] != b.min()[k] || a.max()[k] != b.max()[k])
+                return false;
+        return true;
+    }
+
+    void walk(const bvh_node &node, int depth)
+    {
+        nodes++;
+        auto p = root_area > 0 ? area(node.box) / root_area : 1;
+        expected_nodes += p;
+
+        auto d = node.box.max() - node.box.min();
+        if (d.x() <= 0 || d.y() <= 0 || d.z() <= 0)
+            flat_nodes++;
+        if (node.left == node.right)
+            duplicated_leaves++;
+
+        aabb boxes[2];
+        int prim_children = 0;
+        const shared_ptr<hittable> children[2] = {node.left, node.right};
+        for (int c = 0; c < 2; c++)
+        {
+            children[c]->bounding_box(0, 1, boxes[c]);
+            if (same_box(boxes[c], node.box) && node.left != node.right)
+                stalled_splits++;
+            if (c == 1 && node.right == node.left)
+                break;
+
+            if (typeid(*children[c]) == typeid(bvh_node))
+                walk(static_cast<const bvh_node &>(*children[c]), depth + 1);
+            else
+            {
+                prim_children++;
+                primitives++;
+                expected_prims += p;
+                if (int(depth_histogram.size()) <= depth + 1)
+                    depth_histogram.resize(depth + 2);
+                depth_histogram[depth + 1]++;
+                max_depth = depth + 1 > max_depth ? depth + 1 : max_depth;
+            }
+        }
+        leaf_sizes[prim_children]++;
+
+        if (root_area > 0 && node.left != node.right)
+        {
+            child_area += (area(boxes[0]) + area(boxes[1])) / root_area;
+            vec3 lo, hi;
+            bool disjoint = false;
+            for (int k = 0; k < 3; k++)
+            {
+                lo[k] = ffmax(boxes[0].min()[k], boxes[1].min()[k]);
+                hi[k] = ffmin(boxes[0].max()[k], boxes[1].max()[k]);
+                disjoint = disjoint || lo[k] > hi[k];
+            }
+            if (!disjoint)
+                overlap += area(aabb(lo, hi)) / root_area;
+        }
+    }
+};
+
+// Measured traversal work of random rays through the tree: each ray starts on
+// a sphere around the root box and aims at a random point inside it. The walk
+// mirrors bvh_node::hit, including the closest-hit cutoff, so unlike the
+// surface-area estimate it sees early termination.
+struct bvh_ray_cost
+{
+    double nodes = 0;      // nodes entered per ray
+    double primitives = 0; // primitives tested per ray
+    double hit_rate = 0;
+
+    static bvh_ray_cost measure(const bvh_node &root, int ray_count)
+    {
+        auto center = 0.5 * (root.box.min() + root.box.max());
+        auto radius = 0.5 * (root.box.max() - root.box.min()).length() + 1e-3;
+        long long node_tests = 0, prim_tests = 0, hits = 0;
+        for (int k = 0; k < ray_count; k++)
+        {
+            auto origin = center + radius * random_unit_vector();
+            vec3 target;
+            for (int a = 0; a < 3; a++)
+                target[a] = random_double(root.box.min()[a], root.box.max()[a]);
+            hit_record rec;
+            hits += visit(root, ray(origin, target - origin, random_double()), 0.001, infinity, rec, node_tests,
+                          prim_tests);
+        }
+        bvh_ray_cost cost;
+        cost.nodes = double(node_tests) / ray_count;
+        cost.primitives = double(prim_tests) / ray_count;
+        cost.hit_rate = double(hits) / ray_count;
+        return cost;
+    }
+
+private:
+    static bool visit(const hittable &h, const ray &r, double t_min, double t_max, hit_record &rec,
+                      long long &node_tests, long long &prim_tests)
+    {
+        if (typeid(h) != typeid(bvh_node))
+        {
+            prim_tests++;
+            return h.hit(r, t_min, t_max, rec);
+        }
+        const auto &node = static_cast<const bvh_node &>(h);
+        if (!node.box.hit(r, t_min, t_max))
+            return false;
+        node_tests++;
+        bool hit_left = visit(*node.left, r, t_min, t_max, rec, node_tests, prim_tests);
+        bool hit_right = visit(*node.right, r, t_min, hit_left ? rec.t : t_max, rec, node_tests, prim_tests);
+        return hit_left || hit_right;
+    }
+};
+
+#endif
@@ -28,10 +28,12 @@ public:
         vec3 rd = lens_radius * random_in_unit_disk();
         vec3 offset = u * rd.x() + v * rd.y();
 
-        return ray(
+        ray r(
             origin + offset,
             lower_left_corner + s * horizontal + t * vertical - origin - offset,
             +random_double(time0, time1));
+        r.cone_spread = pixel_spread;
+        return r;
     }
 
 public:
@@ -42,4 +44,5 @@ public:
     vec3 u, v, w;
     double lens_radius;
     double time0, time1;
+    double pixel_spread = 0; // angle subtended by one pixel, for texture filtering
 };
\ No newline at end of file
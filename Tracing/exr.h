@@ -0,0 +1,90 @@
+//exr.h 多通道浮点输出
+#ifndef EXR_H
+#define EXR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct exr_channel
+{
+    std::string name;
+    std::vector<float> data; // width * height values, top row first
+};
+
+// Writes an uncompressed scanline OpenEXR file with one FLOAT plane per channel,
+// readable by any compositing package. Channels are sorted by name as the
+// format requires.
+bool write_exr(const std::string &path, int width, int height, std::vector<exr_channel> channels)
+{
+    std::sort(channels.begin(), channels.end(),
+              [](const exr_channel &a, const exr_channel &b) { return a.name < b.name; });
+
+    std::string header;
+    auto put_bytes = [&](const void *p, size_t n) { header.append(static_cast<const char *>(p), n); };
+    auto put_i32 = [&](int32_t v) { put_bytes(&v, 4); };
+    auto put_f32 = [&](float v) { put_bytes(&v, 4); };
+    auto put_str = [&](const std::string &s) { header.append(s.c_str(), s.size() + 1); };
+    auto put_attr = [&](const std::string &name, const std::string &type, int32_t size) {
+        put_str(name);
+        put_str(type);
+        put_i32(size);
+    };
+
+    put_i32(20000630); // magic
+    put_i32(2);        // version 2, single-part scanline
+
+    int32_t chlist_size = 1;
+    for (const auto &c : channels)
+        chlist_size += int32_t(c.name.size() + 1 + 16);
+    put_attr("channels", "chlist", chlist_size);
+    for (const auto &c : channels)
+    {
+        put_str(c.name);
+        put_i32(2); // FLOAT
+        put_i32(0); // pLinear + reserved
+        put_i32(1); // xSampling
+        put_i32(1); // ySampling
+    }
+    header.push_back('\0');
+
+    put_attr("compression", "compression", 1);
+    header.push_back('\0'); // NO_COMPRESSION
+    put_attr("dataWindow", "box2i", 16);
+    put_i32(0), put_i32(0), put_i32(width - 1), put_i32(height - 1);
+    put_attr("displayWindow", "box2i", 16);
+    put_i32(0), put_i32(0), put_i32(width - 1), put_i32(height - 1);
+    put_attr("lineOrder", "lineOrder", 1);
+    header.push_back('\0'); // INCREASING_Y
+    put_attr("pixelAspectRatio", "float", 4);
+    put_f32(1);
+    put_attr("screenWindowCenter", "v2f", 8);
+    put_f32(0), put_f32(0);
+    put_attr("screenWindowWidth", "float", 4);
+    put_f32(1);
+    header.push_back('\0');
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        return false;
+    out.write(header.data(), header.size());
+
+    const int32_t line_bytes = int32_t(width * channels.size() * sizeof(float));
+    uint64_t offset = header.size() + sizeof(uint64_t) * height;
+    for (int y = 0; y < height; ++y, offset += 8 + line_bytes)
+        out.write(reinterpret_cast<const char *>(&offset), sizeof(offset));
+
+    for (int32_t y = 0; y < height; ++y)
+    {
+        out.write(reinterpret_cast<const char *>(&y), 4);
+        out.write(reinterpret_cast<const char *>(&line_bytes), 4);
+        for (const auto &c : channels)
+            out.write(reinterpret_cast<const char *>(c.data.data() + size_t(y) * width), width * sizeof(float));
+    }
+
+    return bool(out);
+}
+
+#endif
@@ -0,0 +1,300 @@
+//flatten.h 场景展平: 将静态变换烘焙进图元
+#ifndef FLATTEN_H
+#define FLATTEN_H
+
+#include "attribution.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "sphere.h"
+#include "trans.h"
+#include <ostream>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+// A rotation about y followed by a translation, plus a pending flip_face.
+// p_world = R * p_local + offset.
+struct rigid_y
+{
+    double cos_theta = 1, sin_theta = 0;
+    vec3 offset;
+    bool flip = false;
+
+    bool has_rotation() const { return sin_theta != 0 || cos_theta != 1; }
+    bool is_identity() const { return !has_rotation() && offset.length_squared() == 0 && !flip; }
+
+    vec3 rotate(const vec3 &v) const
+    {
+        return vec3(cos_theta * v.x() + sin_theta * v.z(), v.y(), -sin_theta * v.x() + cos_theta * v.z());
+    }
+
+    vec3 point(const vec3 &p) const { return rotate(p) + offset; }
+
+    // this * (rotation about y by child_cos/child_sin, then child_offset)
+    rigid_y then(double child_cos, double child_sin, const vec3 &child_offset) const
+    {
+        rigid_y result = *this;
+        result.cos_theta = cos_theta * child_cos - sin_theta * child_sin;
+        result.sin_theta = sin_theta * child_cos + cos_theta * child_sin;
+        result.offset = point(child_offset);
+        return result;
+    }
+};
+
+// Scene flattening: walks lists, BVHs and translate/rotate_y/flip_face
+// wrappers, and writes the transforms into world-space copies of spheres,
+// moving spheres, boxes and rects (boxes and rects only take translations; a
+// rotated rect is no longer axis aligned). A wrapper around a list or BVH that is also
+// referenced elsewhere is an instance and is kept, as is anything that cannot absorb the
+// accumulated transform; those get a single affine instance. References are counted
+// within the scene graph by count_references() before flattening, so owners outside
+// the scene (a builder's local copy) do not make anything an instance.
+//
+// Flattened primitives keep the face orientation their hit routine reports.
+// The old wrappers recomputed front_face from the already flipped normal and
+// so always reported a front hit.
+class scene_flattener
+{
+public:
+    void flatten(const shared_ptr<hittable> &h, const rigid_y &xf, std::vector<shared_ptr<hittable>> &out)
+    {
+        const auto &type = typeid(*h);
+        if (type == typeid(hittable_list))
+        {
+            for (const auto &object : static_cast<const hittable_list &>(*h).objects)
+                flatten(object, xf, out);
+        }
+        else if (type == typeid(bvh_node))
+        {
+            const auto &node = static_cast<const bvh_node &>(*h);
+            flatten(node.left, xf, out);
+            if (node.right != node.left)
+                flatten(node.right, xf, out);
+        }
+        else if (type == typeid(box))
+        {
+            // Boxes stay whole: the BVH splits 2400 loose thin rects worse than
+            // 400 boxes. A translated box is rebuilt in place.
+            const auto &b = static_cast<const box &>(*h);
+            if (xf.is_identity())
+                out.push_back(h);
+            else if (xf.has_rotation() || xf.flip)
+                out.push_back(wrap(h, xf));
+            else
+            {
+                auto mat = static_cast<const xy_rect &>(*b.sides.objects[0]).mp;
+                out.push_back(make_shared<box>(b.box_min + xf.offset, b.box_max + xf.offset, mat));
+            }
+        }
+        else if (type == typeid(flip_face))
+        {
+            const auto &wrapper = static_cast<const flip_face &>(*h);
+            auto child_xf = xf;
+            child_xf.flip = !child_xf.flip;
+            folded++;
+            flatten(wrapper.ptr, child_xf, out);
+        }
+        else if (type == typeid(translate))
+        {
+            const auto &wrapper = static_cast<const translate &>(*h);
+            auto child_xf = xf.then(1, 0, wrapper.offset);
+            if (instanced(wrapper.ptr))
+                out.push_back(wrap(wrapper.ptr, child_xf));
+            else
+                flatten(wrapper.ptr, child_xf, out);
+        }
+        else if (type == typeid(rotate_y))
+        {
+            const auto &wrapper = static_cast<const rotate_y &>(*h);
+            auto child_xf = xf.then(wrapper.cos_theta, wrapper.sin_theta, vec3(0, 0, 0));
+            if (instanced(wrapper.ptr))
+                out.push_back(wrap(wrapper.ptr, child_xf));
+            else
+                flatten(wrapper.ptr, child_xf, out);
+        }
+        else if (type == typeid(sphere) && !xf.flip)
+        {
+            const auto &s = static_cast<const sphere &>(*h);
+            if (xf.is_identity())
+                out.push_back(h);
+            else
+            {
+                auto moved = make_shared<sphere>(xf.point(s.center), s.radius, s.mat_ptr);
+                set_uv_frame(*moved, xf, s.uv_cos, s.uv_sin);
+                out.push_back(moved);
+            }
+        }
+        else if (type == typeid(moving_sphere) && !xf.flip)
+        {
+            const auto &s = static_cast<const moving_sphere &>(*h);
+            if (xf.is_identity())
+                out.push_back(h);
+            else
+            {
+                auto moved = make_shared<moving_sphere>(xf.point(s.center0), xf.point(s.center1),
+                                                        s.time0, s.time1, s.radius, s.mat_ptr);
+                set_uv_frame(*moved, xf, s.uv_cos, s.uv_sin);
+                out.push_back(moved);
+            }
+        }
+        else if (type == typeid(xy_rect) && !xf.has_rotation())
+        {
+            const auto &r = static_cast<const xy_rect &>(*h);
+            auto o = xf.offset;
+            auto moved = make_shared<xy_rect>(r.x0 + o.x(), r.x1 + o.x(), r.y0 + o.y(), r.y1 + o.y(), r.k + o.z(), r.mp);
+            moved->flipped = r.flipped != xf.flip;
+            out.push_back(moved);
+        }
+        else if (type == typeid(xz_rect) && !xf.has_rotation())
+        {
+            const auto &r = static_cast<const xz_rect &>(*h);
+            auto o = xf.offset;
+            auto moved = make_shared<xz_rect>(r.x0 + o.x(), r.x1 + o.x(), r.z0 + o.z(), r.z1 + o.z(), r.k + o.y(), r.mp);
+            moved->flipped = r.flipped != xf.flip;
+            out.push_back(moved);
+        }
+        else if (type == typeid(yz_rect) && !xf.has_rotation())
+        {
+            const auto &r = static_cast<const yz_rect &>(*h);
+            auto o = xf.offset;
+            auto moved = make_shared<yz_rect>(r.y0 + o.y(), r.y1 + o.y(), r.z0 + o.z(), r.z1 + o.z(), r.k + o.x(), r.mp);
+            moved->flipped = r.flipped != xf.flip;
+            out.push_back(moved);
+        }
+        else
+            out.push_back(wrap(h, xf));
+    }
+
+    // Counts the references to each node from the part of the scene graph
+    // reachable through h; the children of a shared node are counted once.
+    void count_references(const shared_ptr<hittable> &h)
+    {
+        if (!h || ++references[h.get()] > 1)
+            return;
+
+        const auto &type = typeid(*h);
+        if (type == typeid(hittable_list))
+        {
+            for (const auto &object : static_cast<const hittable_list &>(*h).objects)
+                count_references(object);
+        }
+        else if (type == typeid(bvh_node))
+        {
+            const auto &node = static_cast<const bvh_node &>(*h);
+            count_references(node.left);
+            if (node.right != node.left)
+                count_references(node.right);
+        }
+        else if (type == typeid(flip_face))
+            count_references(static_cast<const flip_face &>(*h).ptr);
+        else if (type == typeid(translate))
+            count_references(static_cast<const translate &>(*h).ptr);
+        else if (type == typeid(rotate_y))
+            count_references(static_cast<const rotate_y &>(*h).ptr);
+        else if (type == typeid(instance))
+            count_references(static_cast<const instance &>(*h).object);
+        else if (type == typeid(tagged))
+            count_references(static_cast<const tagged &>(*h).object);
+    }
+
+    int folded = 0; // wrappers removed
+    int kept = 0;   // wrappers left in (or created for) the traversal
+
+private:
+    // A list or BVH referenced by more than this wrapper would be copied once per
+    // reference; single primitives are cheap to copy.
+    bool instanced(const shared_ptr<hittable> &child)
+    {
+        const auto &type = typeid(*child);
+        bool composite = type == typeid(hittable_list) || type == typeid(bvh_node);
+        auto it = references.find(child.get());
+        if (composite && it != references.end() && it->second > 1)
+        {
+            kept++;
+            return true;
+        }
+        folded++;
+        return false;
+    }
+
+    template <typename S>
+    static void set_uv_frame(S &moved, const rigid_y &xf, double uv_cos, double uv_sin)
+    {
+        // Undo the world rotation, then the sphere's own.
+        moved.uv_cos = xf.cos_theta * uv_cos - xf.sin_theta * uv_sin;
+        moved.uv_sin = xf.cos_theta * uv_sin + xf.sin_theta * uv_cos;
+    }
+
+    std::unordered_map<const hittable *, int> references; // from count_references()
+
+    shared_ptr<hittable> wrap(shared_ptr<hittable> h, const rigid_y &xf)
+    {
+        if (xf.has_rotation() || xf.offset.length_squared() > 0)
+        {
+            affine a;
+            a.m[0][0] = a.m[2][2] = xf.cos_theta;
+            a.m[0][2] = xf.sin_theta;
+            a.m[2][0] = -xf.sin_theta;
+            for (int i = 0; i < 3; i++)
+                a.m[i][3] = xf.offset[i];
+            h = make_shared<instance>(h, a);
+            kept++;
+        }
+        if (xf.flip)
+        {
+            h = make_shared<flip_face>(h);
+            kept++;
+        }
+        return h;
+    }
+};
+
+// Flattens every top-level object of a scene. Objects that were lists or BVHs
+// and flatten to several primitives get a new BVH built over the world-space
+// primitives. A tagged top-level object is flattened inside its tag.
+hittable_list flatten_scene(const hittable_list &world, double time0, double time1, std::ostream *log = nullptr)
+{
+    scene_flattener flattener;
+    for (const auto &object : world.objects)
+        flattener.count_references(object);
+
+    hittable_list result;
+    for (auto object : world.objects)
+    {
+        shared_ptr<tagged> tag;
+        if (typeid(*object) == typeid(tagged))
+        {
+            tag = make_shared<tagged>(static_cast<const tagged &>(*object));
+            object = tag->object;
+        }
+
+        std::vector<shared_ptr<hittable>> primitives;
+        flattener.flatten(object, rigid_y(), primitives);
+        shared_ptr<hittable> flat;
+        if (primitives.size() > 1)
+        {
+            hittable_list group;
+            group.objects = primitives;
+            flat = make_shared<bvh_node>(group, time0, time1);
+        }
+        else if (primitives.size() == 1)
+            flat = primitives[0];
+        else
+            continue;
+
+        if (tag)
+        {
+            tag->object = flat;
+            flat = tag;
+        }
+        result.add(flat);
+    }
+
+    if (log)
+        *log << "Flattened scene: " << flattener.folded << " transform wrappers folded, "
+             << flattener.kept << " kept\n";
+    return result;
+}
+
+#endif
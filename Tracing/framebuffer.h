@@ -0,0 +1,76 @@
+//framebuffer.h
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "exr.h"
+#include "vec3.h"
+#include <string>
+#include <vector>
+
+// First-hit data of one camera sample, filled by ray_color at no extra ray cost.
+struct feature_sample
+{
+    vec3 albedo;
+    vec3 normal;
+    double depth;
+    vec3 emission;
+    int material_id; // -1 when the ray escaped
+};
+
+// Float framebuffer holding the per-pixel average radiance plus the arbitrary
+// output variables (AOVs) gathered in the same trace pass. Row 0 is the bottom
+// of the image, as in the render loop.
+class framebuffer
+{
+public:
+    framebuffer(int w, int h)
+        : width(w), height(h), color(w * h), albedo(w * h), normal(w * h), depth(w * h, 0),
+          emission(w * h), material_id(w * h, -1), sample_count(w * h, 0), variance(w * h, 0) {}
+
+    int index(int i, int j) const { return i + width * j; }
+
+    // Writes every channel into one multi-channel float EXR.
+    bool write_aovs(const std::string &path) const
+    {
+        std::vector<exr_channel> channels;
+        auto add_vec3 = [&](const std::string &prefix, const char *names, const std::vector<vec3> &src) {
+            for (int c = 0; c < 3; ++c)
+                channels.push_back({prefix + names[c], plane([&](int p) { return src[p][c]; })});
+        };
+
+        add_vec3("", "RGB", color);
+        add_vec3("albedo.", "RGB", albedo);
+        add_vec3("N.", "XYZ", normal);
+        add_vec3("emission.", "RGB", emission);
+        channels.push_back({"Z", plane([&](int p) { return depth[p]; })});
+        channels.push_back({"id", plane([&](int p) { return double(material_id[p]); })});
+        channels.push_back({"samples", plane([&](int p) { return double(sample_count[p]); })});
+        channels.push_back({"variance", plane([&](int p) { return variance[p]; })});
+
+        return write_exr(path, width, height, channels);
+    }
+
+private:
+    template <typename F>
+    std::vector<float> plane(F value) const
+    {
+        std::vector<float> out(width * height);
+        for (int j = 0; j < height; ++j)
+            for (int i = 0; i < width; ++i)
+                out[i + width * (height - 1 - j)] = float(value(index(i, j)));
+        return out;
+    }
+
+public:
+    int width, height;
+    std::vector<vec3> color;
+    std::vector<vec3> albedo;
+    std::vector<vec3> normal;
+    std::vector<double> depth;
+    std::vector<vec3> emission;
+    std::vector<int> material_id;
+    std::vector<int> sample_count;
+    std::vector<double> variance; // of the pixel mean's luminance
+};
+
+#endif
@@ -0,0 +1,79 @@
+//heatmap.h 遍历开销热力图
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "exr.h"
+#include "stats.h"
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Per-pixel traversal cost read from the TRACING_STATS counters: BVH nodes
+// visited and primitives tested (boxes count through their six rects). Row 0
+// is the bottom of the image, as in the render loop.
+class cost_map
+{
+public:
+    cost_map(int w, int h) : width(w), height(h), nodes(w * h, 0), prims(w * h, 0) {}
+
+    int index(int i, int j) const { return i + width * j; }
+
+    // Counter values to diff against after tracing.
+    static void snapshot(long long &node_count, long long &prim_count)
+    {
+        const auto &s = thread_stats();
+        node_count = s.bvh_nodes_visited;
+        prim_count = s.primitives_tested();
+    }
+
+    // Writes <prefix>.ppm, the node counts false-coloured against the 99th
+    // percentile, and <prefix>.exr with the raw "nodes" and "prims" channels.
+    bool write(const std::string &prefix) const
+    {
+        auto sorted = nodes;
+        std::sort(sorted.begin(), sorted.end());
+        auto scale = std::max(sorted[sorted.size() * 99 / 100], 1.0f);
+
+        std::ofstream out(prefix + ".ppm");
+        out << "P3\n"
+            << width << " " << height << "\n255\n";
+        for (int j = height - 1; j >= 0; --j)
+            for (int i = 0; i < width; ++i)
+            {
+                float rgb[3];
+                heat_color(nodes[index(i, j)] / scale, rgb);
+                out << int(255.99f * rgb[0]) << ' ' << int(255.99f * rgb[1]) << ' ' << int(255.99f * rgb[2]) << '\n';
+            }
+
+        return bool(out) && write_exr(prefix + ".exr", width, height, {{"nodes", flipped(nodes)}, {"prims", flipped(prims)}});
+    }
+
+    // Black - blue - red - yellow - white ramp over [0, 1].
+    static void heat_color(float t, float rgb[3])
+    {
+        static const float stops[5][3] = {{0, 0, 0}, {0, 0, 1}, {1, 0, 0}, {1, 1, 0}, {1, 1, 1}};
+        t = std::min(std::max(t, 0.0f), 1.0f) * 4;
+        int k = std::min(int(t), 3);
+        float f = t - k;
+        for (int c = 0; c < 3; c++)
+            rgb[c] = stops[k][c] + f * (stops[k + 1][c] - stops[k][c]);
+    }
+
+private:
+    std::vector<float> flipped(const std::vector<float> &plane) const
+    {
+        std::vector<float> out(plane.size());
+        for (int j = 0; j < height; ++j)
+            std::copy(plane.begin() + index(0, j), plane.begin() + index(0, j) + width,
+                      out.begin() + index(0, height - 1 - j));
+        return out;
+    }
+
+public:
+    int width, height;
+    std::vector<float> nodes;
+    std::vector<float> prims;
+};
+
+#endif
@@ -15,6 +15,9 @@ struct hit_record
 
     double u; //texture
     double v;
+    double du_ds = 0; // UV change per unit of surface distance, for filtering
+    double dv_ds = 0;
+    double footprint = 0; // width of the ray cone at p
 
     bool front_face;
 
@@ -51,10 +54,12 @@ public:
 public:
     shared_ptr<material> mp;
     double x0, x1, y0, y1, k;
+    bool flipped = false; // flip_face folded in
 };
 
 bool xy_rect::hit(const ray &r, double t0, double t1, hit_record &rec) const
 {
+    STAT(thread_stats().primitive_tests[prim_xy_rect]++);
     auto t = (k - r.origin().z()) / r.direction().z();
     if (t < t0 || t > t1)
         return false;
@@ -64,9 +69,13 @@ bool xy_rect::hit(const ray &r, double t0, double t1, hit_record &rec) const
         return false;
     rec.u = (x - x0) / (x1 - x0);
     rec.v = (y - y0) / (y1 - y0);
+    rec.du_ds = 1 / (x1 - x0);
+    rec.dv_ds = 1 / (y1 - y0);
     rec.t = t;
     vec3 outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
+    if (flipped)
+        rec.front_face = !rec.front_face;
     rec.mat_ptr = mp;
     rec.p = r.at(t);
     return true;
@@ -91,6 +100,7 @@ public:
 public:
     shared_ptr<material> mp;
     double x0, x1, z0, z1, k;
+    bool flipped = false; // flip_face folded in
 };
 
 class yz_rect : public hittable
@@ -112,10 +122,12 @@ public:
 public:
     shared_ptr<material> mp;
     double y0, y1, z0, z1, k;
+    bool flipped = false; // flip_face folded in
 };
 
 bool xz_rect::hit(const ray &r, double t0, double t1, hit_record &rec) const
 {
+    STAT(thread_stats().primitive_tests[prim_xz_rect]++);
     auto t = (k - r.origin().y()) / r.direction().y();
     if (t < t0 || t > t1)
         return false;
@@ -125,9 +137,13 @@ bool xz_rect::hit(const ray &r, double t0, double t1, hit_record &rec) const
         return false;
     rec.u = (x - x0) / (x1 - x0);
     rec.v = (z - z0) / (z1 - z0);
+    rec.du_ds = 1 / (x1 - x0);
+    rec.dv_ds = 1 / (z1 - z0);
     rec.t = t;
     vec3 outward_normal = vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
+    if (flipped)
+        rec.front_face = !rec.front_face;
     rec.mat_ptr = mp;
     rec.p = r.at(t);
     return true;
@@ -135,6 +151,7 @@ bool xz_rect::hit(const ray &r, double t0, double t1, hit_record &rec) const
 
 bool yz_rect::hit(const ray &r, double t0, double t1, hit_record &rec) const
 {
+    STAT(thread_stats().primitive_tests[prim_yz_rect]++);
     auto t = (k - r.origin().x()) / r.direction().x();
     if (t < t0 || t > t1)
         return false;
@@ -144,9 +161,13 @@ bool yz_rect::hit(const ray &r, double t0, double t1, hit_record &rec) const
         return false;
     rec.u = (y - y0) / (y1 - y0);
     rec.v = (z - z0) / (z1 - z0);
+    rec.du_ds = 1 / (y1 - y0);
+    rec.dv_ds = 1 / (z1 - z0);
     rec.t = t;
     vec3 outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
+    if (flipped)
+        rec.front_face = !rec.front_face;
     rec.mat_ptr = mp;
     rec.p = r.at(t);
     return true;
@@ -124,6 +124,7 @@ box::box(const vec3 &p0, const vec3 &p1, shared_ptr<material> ptr)
 
 bool box::hit(const ray &r, double t0, double t1, hit_record &rec) const
 {
+    STAT(thread_stats().primitive_tests[prim_box]++);
     return sides.hit(r, t0, t1, rec);
 }
 
@@ -0,0 +1,173 @@
+//instance.h 仿射实例 (两级加速结构)
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+
+// 3x4 affine transform: p' = A p + t, stored row-major as m[row][col] with the
+// translation in column 3.
+struct affine
+{
+    double m[3][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}};
+
+    static affine translation(const vec3 &t)
+    {
+        affine a;
+        for (int i = 0; i < 3; i++)
+            a.m[i][3] = t[i];
+        return a;
+    }
+
+    static affine scaling(const vec3 &s)
+    {
+        affine a;
+        for (int i = 0; i < 3; i++)
+            a.m[i][i] = s[i];
+        return a;
+    }
+
+    // Rotation by angle degrees about axis (right-handed, as rotate_y).
+    static affine rotation(const vec3 &axis, double angle)
+    {
+        auto u = unit_vector(axis);
+        auto radians = degrees_to_radians(angle);
+        auto c = cos(radians), s = sin(radians), k = 1 - c;
+        affine a;
+        a.m[0][0] = c + u.x() * u.x() * k;
+        a.m[0][1] = u.x() * u.y() * k - u.z() * s;
+        a.m[0][2] = u.x() * u.z() * k + u.y() * s;
+        a.m[1][0] = u.y() * u.x() * k + u.z() * s;
+        a.m[1][1] = c + u.y() * u.y() * k;
+        a.m[1][2] = u.y() * u.z() * k - u.x() * s;
+        a.m[2][0] = u.z() * u.x() * k - u.y() * s;
+        a.m[2][1] = u.z() * u.y() * k + u.x() * s;
+        a.m[2][2] = c + u.z() * u.z() * k;
+        return a;
+    }
+
+    vec3 point(const vec3 &p) const
+    {
+        return vec3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                    m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                    m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    vec3 vector(const vec3 &v) const
+    {
+        return vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                    m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                    m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    // Multiplies by the transpose of the linear part; applied by the inverse
+    // transform this maps normals.
+    vec3 transposed_vector(const vec3 &v) const
+    {
+        return vec3(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+                    m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+                    m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+    }
+
+    double determinant() const
+    {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+               m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+               m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    affine inverse() const
+    {
+        affine r;
+        auto inv_det = 1 / determinant();
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+            {
+                // Cofactor of (j, i).
+                int r0 = (j + 1) % 3, r1 = (j + 2) % 3, c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+                r.m[i][j] = (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) * inv_det;
+            }
+        auto t = r.vector(vec3(m[0][3], m[1][3], m[2][3]));
+        for (int i = 0; i < 3; i++)
+            r.m[i][3] = -t[i];
+        return r;
+    }
+};
+
+// (a * b) p = a (b p)
+inline affine operator*(const affine &a, const affine &b)
+{
+    affine r;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 4; j++)
+        {
+            r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+            if (j == 3)
+                r.m[i][j] += a.m[i][3];
+        }
+    return r;
+}
+
+// A shared object (usually a bottom-level bvh_node) placed in the world by an
+// affine transform. Rays are taken into object space once per instance; the
+// object's geometry is never copied, so a top-level bvh_node over many
+// instances of one object is a two-level acceleration structure.
+class instance : public hittable
+{
+public:
+    instance(shared_ptr<hittable> p, const affine &xf)
+        : object(p), to_world(xf), to_object(xf.inverse())
+    {
+        // Texture filtering rates are per unit of surface distance; assume a
+        // roughly uniform scale.
+        inv_scale = 1 / cbrt(fabs(xf.determinant()));
+
+        aabb box;
+        hasbox = object->bounding_box(0, 1, box);
+        vec3 lo(infinity, infinity, infinity), hi(-infinity, -infinity, -infinity);
+        for (int c = 0; c < 8; c++)
+        {
+            vec3 corner((c & 1) ? box.max().x() : box.min().x(),
+                        (c & 2) ? box.max().y() : box.min().y(),
+                        (c & 4) ? box.max().z() : box.min().z());
+            auto p = to_world.point(corner);
+            for (int a = 0; a < 3; a++)
+            {
+                lo[a] = ffmin(lo[a], p[a]);
+                hi[a] = ffmax(hi[a], p[a]);
+            }
+        }
+        world_box = aabb(lo, hi);
+    }
+
+    virtual bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const
+    {
+        // The direction is not renormalized, so t is the same in both spaces.
+        ray local(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+        if (!object->hit(local, t_min, t_max, rec))
+            return false;
+
+        // The inverse transpose keeps dot(direction, normal) signs, so
+        // front_face carries over.
+        rec.p = r.at(rec.t);
+        rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+        rec.du_ds *= inv_scale;
+        rec.dv_ds *= inv_scale;
+        return true;
+    }
+
+    virtual bool bounding_box(double t0, double t1, aabb &output_box) const
+    {
+        output_box = world_box;
+        return hasbox;
+    }
+
+public:
+    shared_ptr<hittable> object;
+    affine to_world;
+    affine to_object;
+    double inv_scale;
+    aabb world_box;
+    bool hasbox;
+};
+
+#endif
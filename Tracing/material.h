@@ -3,10 +3,13 @@
 #include "hittable_list.h"
 #include "ray.h"
 #include "texture.h"
+#include "texture_program.h"
 
 class material
 {
 public:
+    material() : id(next_id()) {}
+
     virtual bool scatter(
         const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const = 0;
 
@@ -14,24 +17,49 @@ public:
     {
         return vec3(0, 0, 0);
     }
+
+    static int next_id()
+    {
+        static int count = 0;
+        return count++;
+    }
+
+public:
+    int id; // in creation order, for the material ID AOV
 };
 
 class lambertian : public material
 {
 public:
-    lambertian(shared_ptr<texture> a) : albedo(a) {}
+    lambertian(shared_ptr<texture> a) : albedo(a), program(a)
+    {
+        // A constant albedo is read straight from the material.
+        if (program.is_constant())
+        {
+            constant_albedo = true;
+            albedo_color = program.code[0].color;
+        }
+    }
 
     virtual bool scatter(
         const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const
     {
+        STAT(thread_stats().scatter_calls[mat_lambertian]++);
         vec3 scatter_direction = rec.normal + random_unit_vector();
         scattered = ray(rec.p, scatter_direction, r_in.time());
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
+        if (constant_albedo)
+            attenuation = albedo_color;
+        else
+            attenuation = program.filtered_value(
+                rec.u, rec.v, rec.p, rec.du_ds * rec.footprint, rec.dv_ds * rec.footprint);
         return true;
     }
 
 public:
     shared_ptr<texture> albedo;
+    texture_program program;
+    bool constant_albedo = false;
+    vec3 albedo_color;
 };
 
 class metal : public material
@@ -42,6 +70,7 @@ public:
     virtual bool scatter(
         const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const
     {
+        STAT(thread_stats().scatter_calls[mat_metal]++);
         vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
         scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere());
         attenuation = albedo;
@@ -66,6 +95,7 @@ public:
     virtual bool scatter(
         const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const
     {
+        STAT(thread_stats().scatter_calls[mat_dielectric]++);
         attenuation = vec3(1.0, 1.0, 1.0);
         double etai_over_etat = (rec.front_face) ? (1.0 / ref_idx) : (ref_idx);
 
@@ -97,38 +127,42 @@ public:
 class diffuse_light : public material
 {
 public:
-    diffuse_light(shared_ptr<texture> a) : emit(a) {}
+    diffuse_light(shared_ptr<texture> a) : emit(a), program(a) {}
 
     virtual bool scatter(
         const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const
     {
+        STAT(thread_stats().scatter_calls[mat_diffuse_light]++);
         return false;
     }
 
     virtual vec3 emitted(double u, double v, const vec3 &p) const
     {
-        return emit->value(u, v, p);
+        return program.value(u, v, p);
     }
 
 public:
     shared_ptr<texture> emit;
+    texture_program program;
 };
 
 class isotropic : public material
 {
 public:
-    isotropic(shared_ptr<texture> a) : albedo(a) {}
+    isotropic(shared_ptr<texture> a) : albedo(a), program(a) {}
 
     virtual bool scatter(
         const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const
     {
+        STAT(thread_stats().scatter_calls[mat_isotropic]++);
         scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
+        attenuation = program.value(rec.u, rec.v, rec.p);
         return true;
     }
 
 public:
     shared_ptr<texture> albedo;
+    texture_program program;
 };
 
 class constant_medium : public hittable
@@ -160,10 +194,13 @@ bool constant_medium::hit(const ray &r, double t_min, double t_max, hit_record &
     const bool debugging = enableDebug && random_double() < 0.00001;
 
     hit_record rec1, rec2;
+    STAT(thread_stats().primitive_tests[prim_constant_medium]++);
 
+    STAT(thread_stats().medium_boundary_tests++);
     if (!boundary->hit(r, -infinity, infinity, rec1))
         return false;
 
+    STAT(thread_stats().medium_boundary_tests++);
     if (!boundary->hit(r, rec1.t + 0.0001, infinity, rec2))
         return false;
 
@@ -201,6 +238,7 @@ bool constant_medium::hit(const ray &r, double t_min, double t_max, hit_record &
     rec.normal = vec3(1, 0, 0); // arbitrary
     rec.front_face = true;      // also arbitrary
     rec.mat_ptr = phase_function;
+    rec.du_ds = rec.dv_ds = 0;
 
     return true;
 }
@@ -0,0 +1,107 @@
+//parallel.h
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Runs body(i) for every i in [begin, end) on all hardware threads. Indices are
+// handed out one at a time, so rows of uneven cost still balance across threads.
+template <typename F>
+void parallel_for(int begin, int end, F body)
+{
+    std::atomic<int> next(begin);
+    auto worker = [&]() {
+        for (int i = next++; i < end; i = next++)
+            body(i);
+    };
+
+    unsigned thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0)
+        thread_count = 1;
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < thread_count; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads)
+        t.join();
+}
+
+// Fixed set of worker threads consuming a FIFO of tasks, for work that is
+// submitted piecemeal (e.g. texture decodes during scene load).
+class thread_pool
+{
+public:
+    thread_pool(unsigned thread_count = std::thread::hardware_concurrency())
+    {
+        if (thread_count == 0)
+            thread_count = 1;
+        for (unsigned t = 0; t < thread_count; ++t)
+            workers.emplace_back([this]() { run(); });
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &t : workers)
+            t.join();
+    }
+
+    template <typename F>
+    auto submit(F f) -> std::future<decltype(f())>
+    {
+        auto task = std::make_shared<std::packaged_task<decltype(f())()>>(f);
+        auto result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push([task]() { (*task)(); });
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    // Process-wide pool shared by loaders.
+    static thread_pool &shared()
+    {
+        static thread_pool pool;
+        return pool;
+    }
+
+private:
+    void run()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+#endif
@@ -3,6 +3,13 @@
 
 #include "vec3.h"
 
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define PERLIN_SSE
+#include <emmintrin.h>
+#endif
+
 inline double trilinear_interp(double c[2][2][2], double u, double v, double w)
 {
     auto accum = 0.0;
@@ -16,29 +23,93 @@ inline double trilinear_interp(double c[2][2][2], double u, double v, double w)
     return accum;
 }
 
-class perlin
+// Gradient and permutation tables shared read-only by every perlin instance.
+// They are generated at compile time from a fixed seed, so noise no longer
+// depends on rand() state or construction order.
+struct perlin_tables
 {
-public:
-    perlin()
+    static const int point_count = 256;
+
+    struct perm_entry
     {
-        ranvec = new vec3[point_count];
+        uint8_t x, y, z, pad; // the three axis permutations, interleaved
+    };
+
+    double grad[point_count][3];
+    alignas(16) float grad4[point_count][4]; // padded for 128-bit loads
+    perm_entry perm[point_count];
+};
+
+constexpr uint64_t perlin_splitmix(uint64_t &state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+constexpr double perlin_sqrt(double x)
+{
+    double r = x > 1 ? x : 1;
+    for (int i = 0; i < 64; i++)
+        r = 0.5 * (r + x / r);
+    return r;
+}
 
-        for (int i = 0; i < point_count; ++i)
+constexpr perlin_tables make_perlin_tables(uint64_t seed)
+{
+    perlin_tables t = {};
+    uint64_t state = seed;
+
+    for (int i = 0; i < perlin_tables::point_count; i++)
+    {
+        double g[3] = {0, 0, 0};
+        double len2 = 0;
+        while (len2 < 1e-6)
         {
-            ranvec[i] = unit_vector(vec3::random(-1, 1));
+            for (int a = 0; a < 3; a++)
+                g[a] = -1 + 2 * ((perlin_splitmix(state) >> 11) * (1.0 / 9007199254740992.0));
+            len2 = g[0] * g[0] + g[1] * g[1] + g[2] * g[2];
         }
+        auto len = perlin_sqrt(len2);
+        for (int a = 0; a < 3; a++)
+        {
+            t.grad[i][a] = g[a] / len;
+            t.grad4[i][a] = float(g[a] / len);
+        }
+        t.grad4[i][3] = 0;
+    }
 
-        perm_x = perlin_generate_perm();
-        perm_y = perlin_generate_perm();
-        perm_z = perlin_generate_perm();
+    uint8_t perm[3][perlin_tables::point_count] = {};
+    for (int a = 0; a < 3; a++)
+    {
+        for (int i = 0; i < perlin_tables::point_count; i++)
+            perm[a][i] = uint8_t(i);
+        for (int i = perlin_tables::point_count - 1; i > 0; i--)
+        {
+            int target = int(perlin_splitmix(state) % uint64_t(i + 1));
+            uint8_t tmp = perm[a][i];
+            perm[a][i] = perm[a][target];
+            perm[a][target] = tmp;
+        }
     }
+    for (int i = 0; i < perlin_tables::point_count; i++)
+        t.perm[i] = {perm[0][i], perm[1][i], perm[2][i], 0};
+
+    return t;
+}
 
-    ~perlin()
+class perlin
+{
+public:
+    // Per-instance seeds shift the lattice by a hashed offset instead of
+    // copying and reshuffling the tables.
+    perlin(uint32_t seed = 0)
     {
-        delete[] ranvec;
-        delete[] perm_x;
-        delete[] perm_y;
-        delete[] perm_z;
+        auto h = sampler::hash(seed);
+        offset_x = int(h & 255);
+        offset_y = int((h >> 8) & 255);
+        offset_z = int((h >> 16) & 255);
     }
 
     double noise(const vec3 &p) const
@@ -51,22 +122,61 @@ public:
         v = v * v * (3 - 2 * v);
         w = w * w * (3 - 2 * w);
 
-        int i = floor(p.x());
-        int j = floor(p.y());
-        int k = floor(p.z());
+        int i = int(floor(p.x())) + offset_x;
+        int j = int(floor(p.y())) + offset_y;
+        int k = int(floor(p.z())) + offset_z;
         vec3 c[2][2][2];
 
         for (int di = 0; di < 2; di++)
             for (int dj = 0; dj < 2; dj++)
                 for (int dk = 0; dk < 2; dk++)
-                    c[di][dj][dk] = ranvec[perm_x[(i + di) & 255] ^
-                                           perm_y[(j + dj) & 255] ^
-                                           perm_z[(k + dk) & 255]];
+                {
+                    const double *g = tables.grad[tables.perm[(i + di) & 255].x ^
+                                                  tables.perm[(j + dj) & 255].y ^
+                                                  tables.perm[(k + dk) & 255].z];
+                    c[di][dj][dk] = vec3(g[0], g[1], g[2]);
+                }
 
         return perlin_interp(c, u, v, w);
     }
 
+    // Four octaves are evaluated side by side, one per SSE lane, in single
+    // precision; matches reference_turb to within float rounding (~1e-6).
     double turb(const vec3 &p, int depth = 7) const
+    {
+#ifdef PERLIN_SSE
+        auto accum = 0.0;
+        vec3 temp_p = p;
+        auto weight = 1.0;
+
+        for (int base = 0; base < depth; base += 4)
+        {
+            double x[4], y[4], z[4];
+            float octave[4];
+            for (int l = 0; l < 4; l++)
+            {
+                x[l] = temp_p.x();
+                y[l] = temp_p.y();
+                z[l] = temp_p.z();
+                temp_p *= 2;
+            }
+            noise4(x, y, z, octave);
+
+            for (int l = 0; l < 4 && base + l < depth; l++)
+            {
+                accum += weight * octave[l];
+                weight *= 0.5;
+            }
+        }
+
+        return fabs(accum);
+#else
+        return reference_turb(p, depth);
+#endif
+    }
+
+    // Scalar turbulence, kept as the reference for tolerance checks and benchmarks.
+    double reference_turb(const vec3 &p, int depth = 7) const
     {
         auto accum = 0.0;
         vec3 temp_p = p;
@@ -82,36 +192,68 @@ public:
         return fabs(accum);
     }
 
-private:
-    static const int point_count = 256;
+    static constexpr perlin_tables tables = make_perlin_tables(0x5eedu);
 
-    vec3 *ranvec;
-    int *perm_x;
-    int *perm_y;
-    int *perm_z;
+private:
+    int offset_x, offset_y, offset_z;
 
-    static int *perlin_generate_perm()
+#ifdef PERLIN_SSE
+    // Noise at four points. Cell lookup stays scalar; per corner, the four
+    // gradients are loaded whole and transposed into x/y/z lanes, so weights
+    // and dot products run four points per instruction.
+    void noise4(const double *x, const double *y, const double *z, float *out) const
     {
-        auto p = new int[point_count];
-
-        for (int i = 0; i < perlin::point_count; i++)
-            p[i] = i;
+        float fu[4], fv[4], fw[4];
+        int px[2][4], py[2][4], pz[2][4];
+        for (int l = 0; l < 4; l++)
+        {
+            auto fx = floor(x[l]), fy = floor(y[l]), fz = floor(z[l]);
+            int i = int(fx) + offset_x, j = int(fy) + offset_y, k = int(fz) + offset_z;
+            fu[l] = float(x[l] - fx);
+            fv[l] = float(y[l] - fy);
+            fw[l] = float(z[l] - fz);
+            px[0][l] = tables.perm[i & 255].x;
+            px[1][l] = tables.perm[(i + 1) & 255].x;
+            py[0][l] = tables.perm[j & 255].y;
+            py[1][l] = tables.perm[(j + 1) & 255].y;
+            pz[0][l] = tables.perm[k & 255].z;
+            pz[1][l] = tables.perm[(k + 1) & 255].z;
+        }
 
-        permute(p, point_count);
+        const __m128 one = _mm_set1_ps(1), two = _mm_set1_ps(2), three = _mm_set1_ps(3);
+        auto hermite = [&](__m128 t) {
+            return _mm_mul_ps(_mm_mul_ps(t, t), _mm_sub_ps(three, _mm_mul_ps(two, t)));
+        };
 
-        return p;
-    }
+        // Same double smoothing as perlin_interp: offsets use the once-smoothed
+        // fraction, weights smooth it again.
+        __m128 u = hermite(_mm_loadu_ps(fu)), v = hermite(_mm_loadu_ps(fv)), w = hermite(_mm_loadu_ps(fw));
+        __m128 uu = hermite(u), vv = hermite(v), ww = hermite(w);
+        const __m128 wx[2] = {_mm_sub_ps(one, uu), uu};
+        const __m128 wy[2] = {_mm_sub_ps(one, vv), vv};
+        const __m128 wz[2] = {_mm_sub_ps(one, ww), ww};
+        const __m128 dx[2] = {u, _mm_sub_ps(u, one)};
+        const __m128 dy[2] = {v, _mm_sub_ps(v, one)};
+        const __m128 dz[2] = {w, _mm_sub_ps(w, one)};
 
-    static void permute(int *p, int n)
-    {
-        for (int i = n - 1; i > 0; i--)
+        __m128 accum = _mm_setzero_ps();
+        for (int c = 0; c < 8; c++)
         {
-            int target = random_int(0, i);
-            int tmp = p[i];
-            p[i] = p[target];
-            p[target] = tmp;
+            const int di = c >> 2, dj = (c >> 1) & 1, dk = c & 1;
+            __m128 gx = _mm_load_ps(tables.grad4[px[di][0] ^ py[dj][0] ^ pz[dk][0]]);
+            __m128 gy = _mm_load_ps(tables.grad4[px[di][1] ^ py[dj][1] ^ pz[dk][1]]);
+            __m128 gz = _mm_load_ps(tables.grad4[px[di][2] ^ py[dj][2] ^ pz[dk][2]]);
+            __m128 gw = _mm_load_ps(tables.grad4[px[di][3] ^ py[dj][3] ^ pz[dk][3]]);
+            _MM_TRANSPOSE4_PS(gx, gy, gz, gw);
+
+            __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, dx[di]), _mm_mul_ps(gy, dy[dj])),
+                                    _mm_mul_ps(gz, dz[dk]));
+            accum = _mm_add_ps(accum, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(wx[di], wy[dj]), wz[dk]), dot));
         }
+
+        _mm_storeu_ps(out, accum);
     }
+#endif
 
     inline double perlin_interp(vec3 c[2][2][2], double u, double v, double w) const
     {
@@ -132,4 +274,6 @@ private:
     }
 };
 
+constexpr perlin_tables perlin::tables;
+
 #endif
\ No newline at end of file
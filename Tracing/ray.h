@@ -23,5 +23,10 @@ public:
     vec3 orig;
     vec3 dir;
     double tm;
+
+    // Ray cone for texture filtering: width at the origin and growth per unit
+    // of travelled distance.
+    double cone_width = 0;
+    double cone_spread = 0;
 };
 #endif
\ No newline at end of file
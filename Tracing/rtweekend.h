@@ -3,6 +3,7 @@
 #define RTWEEKEND_H
 
 #include "ray.h"
+#include "stats.h"
 #include "vec3.h"
 #include <cmath>
 #include <cstdlib>
@@ -33,6 +34,7 @@ public:
 
     inline bool hit(const ray &r, double tmin, double tmax) const
     {
+        STAT(thread_stats().aabb_tests++);
         for (int a = 0; a < 3; a++)
         {
             auto invD = 1.0f / r.direction()[a];
@@ -0,0 +1,112 @@
+//sampler.h 低差异采样 (Owen-scrambled Sobol)
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+
+// Hands out stratified samples per pixel, per sample index and per path
+// dimension. Each dimension (or 2D pair) draws from the first two Sobol
+// dimensions with its own index shuffle and Owen scramble, seeded by a hash of
+// pixel and dimension, so dimensions stay decorrelated without needing
+// direction numbers for hundreds of Sobol dimensions (Burley 2020).
+class sampler
+{
+public:
+    sampler(uint32_t s = 0) : seed(s), pixel_seed(0), sample_index(0), dimension(0) {}
+
+    void start_pixel(int i, int j)
+    {
+        pixel_seed = hash(seed ^ hash(uint32_t(i) ^ hash(uint32_t(j))));
+    }
+
+    void start_sample(uint32_t index)
+    {
+        sample_index = index;
+        dimension = 0;
+    }
+
+    double get_1d()
+    {
+        auto dim_seed = hash(pixel_seed ^ hash(dimension++));
+        auto index = nested_uniform_scramble(sample_index, dim_seed);
+        return to_unit(nested_uniform_scramble(sobol0(index), hash(dim_seed ^ 0x9e3779b9u)));
+    }
+
+    void get_2d(double &a, double &b)
+    {
+        auto dim_seed = hash(pixel_seed ^ hash(dimension));
+        dimension += 2;
+        auto index = nested_uniform_scramble(sample_index, dim_seed);
+        a = to_unit(nested_uniform_scramble(sobol0(index), hash(dim_seed ^ 0x9e3779b9u)));
+        b = to_unit(nested_uniform_scramble(sobol1(index), hash(dim_seed ^ 0x85ebca6bu)));
+    }
+
+    static uint32_t hash(uint32_t x)
+    {
+        // lowbias32
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+private:
+    static uint32_t reverse_bits(uint32_t x)
+    {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    // Sobol dimension 0 is the van der Corput sequence.
+    static uint32_t sobol0(uint32_t index)
+    {
+        return reverse_bits(index);
+    }
+
+    // Sobol dimension 1 (primitive polynomial x + 1).
+    static uint32_t sobol1(uint32_t index)
+    {
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+            if (index & 1)
+                result ^= v;
+        return result;
+    }
+
+    static uint32_t laine_karras_permutation(uint32_t x, uint32_t s)
+    {
+        x += s;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
+    }
+
+    static uint32_t nested_uniform_scramble(uint32_t x, uint32_t s)
+    {
+        return reverse_bits(laine_karras_permutation(reverse_bits(x), s));
+    }
+
+    static double to_unit(uint32_t x)
+    {
+        return x * (1.0 / 4294967296.0);
+    }
+
+public:
+    uint32_t seed;
+    uint32_t pixel_seed;
+    uint32_t sample_index;
+    uint32_t dimension;
+};
+
+// The sampler the current thread's random_double() draws from. When null the
+// plain pseudo-random generator is used (scene construction, random sampling).
+thread_local sampler *active_sampler = nullptr;
+
+#endif
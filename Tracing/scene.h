@@ -0,0 +1,132 @@
+//scene.h 场景根节点: 有界物体进 BVH, 无界或巨大物体单独测试
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "attribution.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+// The world as the renderer sees it. Bounded top-level objects go into one
+// BVH. Objects without a bounding box, and objects so large that their box
+// would swallow everything else (a global medium inside a radius-5000
+// sphere), stay in a short side list that every ray tests after the BVH.
+// Such an object in the BVH would make the root box, and one whole subtree,
+// cover the scene, and an object without bounds cannot go in at all.
+// The renderers take a scene_root rather than a list, so a scene is never
+// traced through a linear top-level list; it is built once the world is
+// final, when rendering starts.
+class scene_root : public hittable
+{
+public:
+    // An object is huge when its box has more than huge_ratio times the
+    // surface area of the box of all remaining bounded objects.
+    scene_root(const hittable_list &world, double time0, double time1, double huge_ratio = 16)
+    {
+        std::vector<shared_ptr<hittable>> objects;
+        std::vector<aabb> boxes;
+        for (const auto &object : world.objects)
+        {
+            aabb b;
+            if (object->bounding_box(time0, time1, b))
+            {
+                objects.push_back(object);
+                boxes.push_back(b);
+            }
+            else
+                set_aside(object, "unbounded");
+        }
+
+        // Peel off the largest box while it dwarfs the rest.
+        while (objects.size() > 1)
+        {
+            size_t largest = 0;
+            for (size_t k = 1; k < boxes.size(); k++)
+                if (surface_area(boxes[k]) > surface_area(boxes[largest]))
+                    largest = k;
+
+            aabb rest;
+            bool first = true;
+            for (size_t k = 0; k < boxes.size(); k++)
+                if (k != largest)
+                {
+                    rest = first ? boxes[k] : surrounding_box(rest, boxes[k]);
+                    first = false;
+                }
+            if (surface_area(boxes[largest]) <= huge_ratio * surface_area(rest))
+                break;
+
+            set_aside(objects[largest], "huge");
+            objects.erase(objects.begin() + largest);
+            boxes.erase(boxes.begin() + largest);
+        }
+
+        in_bvh = int(objects.size());
+        if (objects.size() > 1)
+            bounded = make_shared<bvh_node>(objects, 0, objects.size(), time0, time1);
+        else if (objects.size() == 1)
+            bounded = objects[0];
+    }
+
+    virtual bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const
+    {
+        bool hit_anything = bounded && bounded->hit(r, t_min, t_max, rec);
+        if (side.objects.empty())
+            return hit_anything;
+        return side.hit(r, t_min, hit_anything ? rec.t : t_max, rec) || hit_anything;
+    }
+
+    virtual bool bounding_box(double t0, double t1, aabb &output_box) const
+    {
+        if (!bounded)
+            return side.bounding_box(t0, t1, output_box);
+        if (!bounded->bounding_box(t0, t1, output_box))
+            return false;
+        if (side.objects.empty())
+            return true;
+
+        aabb side_box;
+        if (!side.bounding_box(t0, t1, side_box))
+            return false;
+        output_box = surrounding_box(output_box, side_box);
+        return true;
+    }
+
+    void report(std::ostream &out) const
+    {
+        out << "Scene root: " << in_bvh << " objects in the BVH, " << side.objects.size() << " outside";
+        for (size_t k = 0; k < side.objects.size(); k++)
+            out << (k ? ", " : ": ") << label(*side.objects[k]) << " (" << reasons[k] << ")";
+        out << "\n";
+    }
+
+    shared_ptr<hittable> bounded; // bvh_node over the bounded objects, or the only one
+    hittable_list side;           // unbounded and huge objects, tested linearly
+    std::vector<const char *> reasons;
+    int in_bvh = 0;
+
+private:
+    void set_aside(const shared_ptr<hittable> &object, const char *reason)
+    {
+        side.add(object);
+        reasons.push_back(reason);
+    }
+
+    static double surface_area(const aabb &b)
+    {
+        auto d = b.max() - b.min();
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    static std::string label(const hittable &object)
+    {
+        if (typeid(object) == typeid(tagged))
+            return static_cast<const tagged &>(object).name;
+        return type_label(typeid(object));
+    }
+};
+
+#endif
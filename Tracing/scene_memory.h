@@ -0,0 +1,340 @@
+//scene_memory.h 场景内存占用统计
+#ifndef SCENE_MEMORY_H
+#define SCENE_MEMORY_H
+
+#include "attribution.h"
+#include "baked_texture.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "tiled_texture.h"
+#include "trans.h"
+#include "volume.h"
+#include <map>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <unordered_set>
+#include <vector>
+
+// Memory accounting of a scene graph. Objects shared by several owners are
+// counted once. Each object is charged its own size plus the heap blocks it
+// owns (vectors, texel planes); the allocator overhead column is what the
+// heap adds on top: the shared_ptr control block of each make_shared
+// allocation and glibc's chunk header and 16-byte rounding. Types the walker
+// does not know are counted by number only. Static tables (perlin) and the
+// out-of-core tile cache are not part of the scene and are left out.
+class scene_memory
+{
+public:
+    struct entry
+    {
+        long long count = 0;
+        size_t bytes = 0;    // object and owned payload
+        size_t overhead = 0; // control blocks and allocator
+    };
+
+    // Bytes glibc reserves for a malloc(n) on a 64-bit target.
+    static size_t heap_block(size_t n)
+    {
+        size_t chunk = (n + 8 + 15) & ~size_t(15);
+        return chunk < 32 ? 32 : chunk;
+    }
+
+    void add_scene(const hittable_list &world)
+    {
+        charge(structure, "world list", 0, vector_bytes(world.objects), 0);
+        for (size_t k = 0; k < world.objects.size(); k++)
+        {
+            auto object = world.objects[k];
+            std::string name = "#" + std::to_string(k);
+            if (typeid(*object) == typeid(tagged))
+                name = static_cast<const tagged &>(*object).name;
+
+            auto before = total();
+            auto bvh_before = bvh_bytes();
+            visit(object, nullptr);
+            auto after = total();
+            objects.push_back({name, after.bytes - before.bytes + after.overhead - before.overhead,
+                               bvh_bytes() - bvh_before});
+        }
+    }
+
+    struct object_total
+    {
+        std::string name;
+        size_t bytes;     // with overhead
+        size_t bvh_bytes; // bvh_node part, with overhead
+    };
+
+    entry total() const
+    {
+        entry sum;
+        for (const auto *group : {&primitives, &structure, &materials, &textures})
+            for (const auto &e : *group)
+            {
+                sum.count += e.second.count;
+                sum.bytes += e.second.bytes;
+                sum.overhead += e.second.overhead;
+            }
+        return sum;
+    }
+
+    void report(std::ostream &out) const
+    {
+        auto kb = [](size_t bytes) { return double(bytes) / 1024; };
+        auto section = [&](const char *title, const std::map<std::string, entry> &group) {
+            out << title << "\n";
+            for (const auto &e : group)
+                out << "  " << e.first << std::string(e.first.size() < 30 ? 30 - e.first.size() : 1, ' ')
+                    << e.second.count << "  " << kb(e.second.bytes) << " KB + " << kb(e.second.overhead)
+                    << " KB overhead\n";
+        };
+        section("Primitives (count, payload, overhead)", primitives);
+        section("Structure", structure);
+        section("Materials", materials);
+        section("Textures", textures);
+        out << "Top-level objects (including everything first reached through them)\n";
+        for (const auto &o : objects)
+            out << "  " << o.name << std::string(o.name.size() < 30 ? 30 - o.name.size() : 1, ' ') << kb(o.bytes)
+                << " KB, of which BVH " << kb(o.bvh_bytes) << " KB\n";
+        auto sum = total();
+        out << "Total: " << kb(sum.bytes + sum.overhead) << " KB (" << kb(sum.bytes) << " KB payload, "
+            << kb(sum.overhead) << " KB allocator overhead)\n";
+    }
+
+    std::map<std::string, entry> primitives; // geometry, by class
+    std::map<std::string, entry> structure;  // lists, BVH nodes and wrappers
+    std::map<std::string, entry> materials;  // by class
+    std::map<std::string, entry> textures;   // by class; images by size
+    std::vector<object_total> objects;
+
+private:
+    template <typename T>
+    static size_t vector_bytes(const std::vector<T> &v)
+    {
+        return v.capacity() * sizeof(T);
+    }
+
+    // One make_shared allocation of object_size bytes, one owned heap block of
+    // owned bytes, and extra_overhead already worked out by the caller.
+    static void charge(std::map<std::string, entry> &group, const std::string &name, size_t object_size,
+                       size_t owned = 0, size_t extra_overhead = 0)
+    {
+        auto &e = group[name];
+        if (object_size)
+        {
+            e.count++;
+            e.bytes += object_size;
+            e.overhead += heap_block(object_size + 16) - object_size; // control block: vptr + two counts
+        }
+        e.bytes += owned;
+        e.overhead += owned ? heap_block(owned) - owned : 0;
+        e.overhead += extra_overhead;
+    }
+
+    size_t bvh_bytes() const
+    {
+        auto it = structure.find(type_label(typeid(bvh_node)));
+        return it == structure.end() ? 0 : it->second.bytes + it->second.overhead;
+    }
+
+    bool first_visit(const void *p)
+    {
+        return p && seen.insert(p).second;
+    }
+
+    // into, when set, charges the object to that primitive class (a box's sides).
+    void visit(const shared_ptr<hittable> &h, const char *into)
+    {
+        if (!first_visit(h.get()))
+            return;
+
+        const auto &type = typeid(*h);
+        auto label = type_label(type);
+        auto &group = into ? primitives : structure;
+        auto name = into ? std::string(into) : label;
+
+        if (type == typeid(hittable_list))
+        {
+            const auto &list = static_cast<const hittable_list &>(*h);
+            charge(group, name, sizeof(hittable_list), vector_bytes(list.objects));
+            for (const auto &o : list.objects)
+                visit(o, into);
+        }
+        else if (type == typeid(bvh_node))
+        {
+            const auto &node = static_cast<const bvh_node &>(*h);
+            charge(group, name, sizeof(bvh_node));
+            visit(node.left, into);
+            visit(node.right, into);
+        }
+        else if (type == typeid(box))
+        {
+            // The sides and their flip_face wrappers add bytes, not boxes.
+            const auto &b = static_cast<const box &>(*h);
+            const char *part = into ? into : "box";
+            auto count = primitives[part].count;
+            charge(primitives, part, sizeof(box), vector_bytes(b.sides.objects));
+            for (const auto &side : b.sides.objects)
+                visit(side, part);
+            primitives[part].count = count + (into ? 0 : 1);
+        }
+        else if (type == typeid(flip_face))
+        {
+            charge(group, name, sizeof(flip_face));
+            visit(static_cast<const flip_face &>(*h).ptr, into);
+        }
+        else if (type == typeid(translate))
+        {
+            charge(group, name, sizeof(translate));
+            visit(static_cast<const translate &>(*h).ptr, into);
+        }
+        else if (type == typeid(rotate_y))
+        {
+            charge(group, name, sizeof(rotate_y));
+            visit(static_cast<const rotate_y &>(*h).ptr, into);
+        }
+        else if (type == typeid(instance))
+        {
+            charge(group, name, sizeof(instance));
+            visit(static_cast<const instance &>(*h).object, into);
+        }
+        else if (type == typeid(tagged))
+        {
+            const auto &t = static_cast<const tagged &>(*h);
+            charge(group, name, sizeof(tagged), t.name.capacity() > 15 ? t.name.capacity() + 1 : 0);
+            visit(t.object, into);
+        }
+        else if (type == typeid(constant_medium))
+        {
+            const auto &m = static_cast<const constant_medium &>(*h);
+            charge(primitives, into ? into : label, sizeof(constant_medium));
+            visit(m.boundary, into);
+            visit_material(m.phase_function);
+        }
+        else if (type == typeid(heterogeneous_medium))
+        {
+            const auto &m = static_cast<const heterogeneous_medium &>(*h);
+            charge(primitives, into ? into : label, sizeof(heterogeneous_medium), vector_bytes(m.majorants));
+            if (first_visit(m.grid.get()))
+                charge(primitives, "density_grid", sizeof(density_grid), vector_bytes(m.grid->values));
+            visit_material(m.phase_function);
+        }
+        else if (type == typeid(sphere))
+        {
+            charge(primitives, into ? into : label, sizeof(sphere));
+            visit_material(static_cast<const sphere &>(*h).mat_ptr);
+        }
+        else if (type == typeid(moving_sphere))
+        {
+            charge(primitives, into ? into : label, sizeof(moving_sphere));
+            visit_material(static_cast<const moving_sphere &>(*h).mat_ptr);
+        }
+        else if (type == typeid(xy_rect))
+            rect(static_cast<const xy_rect &>(*h), into, label);
+        else if (type == typeid(xz_rect))
+            rect(static_cast<const xz_rect &>(*h), into, label);
+        else if (type == typeid(yz_rect))
+            rect(static_cast<const yz_rect &>(*h), into, label);
+        else
+            primitives[label + " (size unknown)"].count++;
+    }
+
+    template <typename R>
+    void rect(const R &r, const char *into, const std::string &label)
+    {
+        charge(primitives, into ? into : label, sizeof(R));
+        visit_material(r.mp);
+    }
+
+    void visit_material(const shared_ptr<material> &m)
+    {
+        if (!first_visit(m.get()))
+            return;
+
+        const auto &type = typeid(*m);
+        auto label = type_label(type);
+        if (type == typeid(lambertian))
+        {
+            const auto &l = static_cast<const lambertian &>(*m);
+            charge(materials, label, sizeof(lambertian), vector_bytes(l.program.code));
+            visit_texture(l.albedo);
+        }
+        else if (type == typeid(diffuse_light))
+        {
+            const auto &l = static_cast<const diffuse_light &>(*m);
+            charge(materials, label, sizeof(diffuse_light), vector_bytes(l.program.code));
+            visit_texture(l.emit);
+        }
+        else if (type == typeid(isotropic))
+        {
+            const auto &l = static_cast<const isotropic &>(*m);
+            charge(materials, label, sizeof(isotropic), vector_bytes(l.program.code));
+            visit_texture(l.albedo);
+        }
+        else if (type == typeid(metal))
+            charge(materials, label, sizeof(metal));
+        else if (type == typeid(dielectric))
+            charge(materials, label, sizeof(dielectric));
+        else
+            materials[label + " (size unknown)"].count++;
+    }
+
+    void visit_texture(const shared_ptr<texture> &t)
+    {
+        if (!first_visit(t.get()))
+            return;
+
+        const auto &type = typeid(*t);
+        auto label = type_label(type);
+        if (type == typeid(constant_texture))
+            charge(textures, label, sizeof(constant_texture));
+        else if (type == typeid(noise_texture))
+            charge(textures, label, sizeof(noise_texture));
+        else if (type == typeid(checker_texture))
+        {
+            const auto &c = static_cast<const checker_texture &>(*t);
+            charge(textures, label, sizeof(checker_texture));
+            visit_texture(c.even);
+            visit_texture(c.odd);
+        }
+        else if (type == typeid(image_texture))
+            image(static_cast<const image_texture &>(*t));
+        else if (type == typeid(baked_texture))
+        {
+            const auto &b = static_cast<const baked_texture &>(*t);
+            charge(textures, label, sizeof(baked_texture));
+            visit_texture(b.source);
+            if (first_visit(b.baked.get()))
+                image(*b.baked);
+        }
+        else if (type == typeid(tiled_image_texture))
+        {
+            const auto &tiled = static_cast<const tiled_image_texture &>(*t);
+            charge(textures, label, sizeof(tiled_image_texture), vector_bytes(tiled.levels));
+        }
+        else
+            textures[label + " (size unknown)"].count++;
+    }
+
+    void image(const image_texture &t)
+    {
+        size_t owned = vector_bytes(t.levels), owned_overhead = heap_block(owned) - owned;
+        for (const auto &level : t.levels)
+            for (size_t bytes : {vector_bytes(level.texels), vector_bytes(level.blocks)})
+                if (bytes)
+                {
+                    owned += bytes;
+                    owned_overhead += heap_block(bytes) - bytes;
+                }
+        auto name = "image_texture " + std::to_string(t.nx) + "x" + std::to_string(t.ny);
+        charge(textures, name, sizeof(image_texture), 0, owned_overhead);
+        textures[name].bytes += owned;
+    }
+
+    std::unordered_set<const void *> seen;
+};
+
+#endif
@@ -13,6 +13,28 @@ void get_sphere_uv(const vec3 &p, double &u, double &v)
     v = (theta + pi / 2) / pi;
 }
 
+// Inverse of get_sphere_uv: the point on the unit sphere with coordinates uv.
+inline vec3 sphere_point(double u, double v)
+{
+    auto phi = (1 - u) * 2 * pi - pi;
+    auto theta = v * pi - pi / 2;
+    return vec3(cos(theta) * cos(phi), sin(theta), cos(theta) * sin(phi));
+}
+
+// Sets uv and its rate of change per unit of surface distance on a sphere.
+// uv_cos/uv_sin undo a rotation about y folded into the sphere, so its texture
+// stays put.
+inline void set_sphere_uv(hit_record &rec, const vec3 &outward_normal, double radius,
+                          double uv_cos = 1, double uv_sin = 0)
+{
+    vec3 n(uv_cos * outward_normal.x() - uv_sin * outward_normal.z(), outward_normal.y(),
+           uv_sin * outward_normal.x() + uv_cos * outward_normal.z());
+    get_sphere_uv(n, rec.u, rec.v);
+    auto ring = ffmax(sqrt(1 - outward_normal.y() * outward_normal.y()), 1e-3);
+    rec.du_ds = 1 / (2 * pi * radius * ring);
+    rec.dv_ds = 1 / (pi * radius);
+}
+
 class sphere : public hittable
 {
 public:
@@ -26,11 +48,13 @@ public:
     vec3 center;
     double radius;
     shared_ptr<material> mat_ptr;
+    double uv_cos = 1, uv_sin = 0; // see set_sphere_uv
 };
 
 //加入射入面判别
 bool sphere::hit(const ray &r, double t_min, double t_max, hit_record &rec) const
 {
+    STAT(thread_stats().primitive_tests[prim_sphere]++);
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -47,6 +71,7 @@ bool sphere::hit(const ray &r, double t_min, double t_max, hit_record &rec) cons
             rec.p = r.at(rec.t);
             vec3 outward_normal = (rec.p - center) / radius;
             rec.set_face_normal(r, outward_normal);
+            set_sphere_uv(rec, outward_normal, radius, uv_cos, uv_sin);
             rec.mat_ptr = mat_ptr;
             return true;
         }
@@ -57,6 +82,7 @@ bool sphere::hit(const ray &r, double t_min, double t_max, hit_record &rec) cons
             rec.p = r.at(rec.t);
             vec3 outward_normal = (rec.p - center) / radius;
             rec.set_face_normal(r, outward_normal);
+            set_sphere_uv(rec, outward_normal, radius, uv_cos, uv_sin);
             rec.mat_ptr = mat_ptr;
             return true;
         }
@@ -86,6 +112,7 @@ public:
     double time0, time1;
     double radius;
     shared_ptr<material> mat_ptr;
+    double uv_cos = 1, uv_sin = 0; // see set_sphere_uv
 };
 
 vec3 moving_sphere::center(double time) const
@@ -95,6 +122,7 @@ vec3 moving_sphere::center(double time) const
 
 bool moving_sphere::hit(const ray &r, double t_min, double t_max, hit_record &rec) const
 {
+    STAT(thread_stats().primitive_tests[prim_moving_sphere]++);
     vec3 oc = r.origin() - center(r.time());
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -113,6 +141,7 @@ bool moving_sphere::hit(const ray &r, double t_min, double t_max, hit_record &re
             rec.p = r.at(rec.t);
             vec3 outward_normal = (rec.p - center(r.time())) / radius;
             rec.set_face_normal(r, outward_normal);
+            set_sphere_uv(rec, outward_normal, radius, uv_cos, uv_sin);
             rec.mat_ptr = mat_ptr;
             return true;
         }
@@ -124,6 +153,7 @@ bool moving_sphere::hit(const ray &r, double t_min, double t_max, hit_record &re
             rec.p = r.at(rec.t);
             vec3 outward_normal = (rec.p - center(r.time())) / radius;
             rec.set_face_normal(r, outward_normal);
+            set_sphere_uv(rec, outward_normal, radius, uv_cos, uv_sin);
             rec.mat_ptr = mat_ptr;
             return true;
         }
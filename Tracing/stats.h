@@ -0,0 +1,213 @@
+//stats.h 光线与遍历统计
+#ifndef STATS_H
+#define STATS_H
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Ray and traversal counters, compiled in with -DTRACING_STATS. Each thread
+// counts into its own block with plain increments; render_stats::total() sums
+// the blocks of every thread that has counted so far, so call it once the
+// render threads have been joined. Without the flag STAT() expands to nothing.
+#ifdef TRACING_STATS
+#define STAT(statement) statement
+#else
+#define STAT(statement)
+#endif
+
+enum primitive_kind
+{
+    prim_sphere,
+    prim_moving_sphere,
+    prim_xy_rect,
+    prim_xz_rect,
+    prim_yz_rect,
+    prim_box,
+    prim_constant_medium,
+    prim_heterogeneous_medium,
+    primitive_kind_count
+};
+
+enum material_kind
+{
+    mat_lambertian,
+    mat_metal,
+    mat_dielectric,
+    mat_diffuse_light,
+    mat_isotropic,
+    material_kind_count
+};
+
+struct render_stats
+{
+    static const int max_bounces = 32;
+
+    long long rays_by_bounce[max_bounces] = {}; // [0] are camera rays
+    long long bvh_nodes_visited = 0;
+    long long aabb_tests = 0;
+    long long primitive_tests[primitive_kind_count] = {};
+    long long scatter_calls[material_kind_count] = {};
+    long long medium_boundary_tests = 0;
+    long long paths_depth_limit = 0;
+    long long paths_absorbed = 0; // scatter() returned false, lights included
+    long long paths_escaped = 0;
+
+    int depth_limit = 0; // max_depth of the path being traced, to turn depth into a bounce
+
+    void count_ray(int depth)
+    {
+        int bounce = depth_limit - depth;
+        rays_by_bounce[bounce < 0 ? 0 : bounce < max_bounces ? bounce : max_bounces - 1]++;
+    }
+
+    render_stats &operator+=(const render_stats &s)
+    {
+        for (int b = 0; b < max_bounces; b++)
+            rays_by_bounce[b] += s.rays_by_bounce[b];
+        bvh_nodes_visited += s.bvh_nodes_visited;
+        aabb_tests += s.aabb_tests;
+        for (int k = 0; k < primitive_kind_count; k++)
+            primitive_tests[k] += s.primitive_tests[k];
+        for (int k = 0; k < material_kind_count; k++)
+            scatter_calls[k] += s.scatter_calls[k];
+        medium_boundary_tests += s.medium_boundary_tests;
+        paths_depth_limit += s.paths_depth_limit;
+        paths_absorbed += s.paths_absorbed;
+        paths_escaped += s.paths_escaped;
+        return *this;
+    }
+
+    // Primitive tests, not counting boxes on top of their six rects.
+    long long primitives_tested() const
+    {
+        long long n = 0;
+        for (int k = 0; k < primitive_kind_count; k++)
+            if (k != prim_box)
+                n += primitive_tests[k];
+        return n;
+    }
+
+    long long rays() const
+    {
+        long long n = 0;
+        for (auto c : rays_by_bounce)
+            n += c;
+        return n;
+    }
+
+    static const char *primitive_name(int k)
+    {
+        static const char *names[] = {"sphere", "moving_sphere", "xy_rect", "xz_rect", "yz_rect",
+                                      "box", "constant_medium", "heterogeneous_medium"};
+        return names[k];
+    }
+
+    static const char *material_name(int k)
+    {
+        static const char *names[] = {"lambertian", "metal", "dielectric", "diffuse_light", "isotropic"};
+        return names[k];
+    }
+
+    // Registers a zeroed block for the calling thread.
+    static render_stats *register_thread()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        registry().emplace_back(new render_stats);
+        return registry().back().get();
+    }
+
+    static render_stats total()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        render_stats sum;
+        for (const auto &s : registry())
+            sum += *s;
+        return sum;
+    }
+
+    // Zeroes every thread's counters; not safe while threads are counting.
+    static void reset()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        for (auto &s : registry())
+        {
+            auto limit = s->depth_limit;
+            *s = render_stats();
+            s->depth_limit = limit;
+        }
+    }
+
+    void print_table(std::ostream &out) const
+    {
+        auto row = [&](const char *name, long long n) {
+            std::string label(name);
+            out << "  " << label << std::string(label.size() < 26 ? 26 - label.size() : 1, ' ') << n << "\n";
+        };
+        out << "Render statistics\n";
+        row("camera rays", rays_by_bounce[0]);
+        for (int b = 1; b < max_bounces; b++)
+            if (rays_by_bounce[b])
+                row(("bounce " + std::to_string(b) + " rays").c_str(), rays_by_bounce[b]);
+        row("bvh nodes visited", bvh_nodes_visited);
+        row("aabb tests", aabb_tests);
+        for (int k = 0; k < primitive_kind_count; k++)
+            if (primitive_tests[k])
+                row((std::string(primitive_name(k)) + " tests").c_str(), primitive_tests[k]);
+        for (int k = 0; k < material_kind_count; k++)
+            if (scatter_calls[k])
+                row((std::string(material_name(k)) + " scatters").c_str(), scatter_calls[k]);
+        row("medium boundary tests", medium_boundary_tests);
+        row("paths ended by depth", paths_depth_limit);
+        row("paths absorbed", paths_absorbed);
+        row("paths escaped", paths_escaped);
+        if (rays())
+            out << "  per ray: " << double(bvh_nodes_visited) / rays() << " nodes, "
+                << double(aabb_tests) / rays() << " aabb tests\n";
+    }
+
+    void write_json(std::ostream &out) const
+    {
+        out << "{\n  \"rays_by_bounce\": [";
+        int last = max_bounces;
+        while (last > 1 && rays_by_bounce[last - 1] == 0)
+            last--;
+        for (int b = 0; b < last; b++)
+            out << (b ? ", " : "") << rays_by_bounce[b];
+        out << "],\n  \"bvh_nodes_visited\": " << bvh_nodes_visited << ",\n  \"aabb_tests\": " << aabb_tests
+            << ",\n  \"primitive_tests\": {";
+        for (int k = 0; k < primitive_kind_count; k++)
+            out << (k ? ", " : "") << "\"" << primitive_name(k) << "\": " << primitive_tests[k];
+        out << "},\n  \"scatter_calls\": {";
+        for (int k = 0; k < material_kind_count; k++)
+            out << (k ? ", " : "") << "\"" << material_name(k) << "\": " << scatter_calls[k];
+        out << "},\n  \"medium_boundary_tests\": " << medium_boundary_tests
+            << ",\n  \"paths\": {\"depth_limit\": " << paths_depth_limit << ", \"absorbed\": " << paths_absorbed
+            << ", \"escaped\": " << paths_escaped << "}\n}\n";
+    }
+
+private:
+    static std::vector<std::unique_ptr<render_stats>> &registry()
+    {
+        static std::vector<std::unique_ptr<render_stats>> blocks;
+        return blocks;
+    }
+
+    static std::mutex &registry_mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+};
+
+// The calling thread's counters. Blocks outlive their threads so that totals
+// still include workers that have exited.
+inline render_stats &thread_stats()
+{
+    thread_local render_stats *local = render_stats::register_thread();
+    return *local;
+}
+
+#endif
@@ -3,11 +3,23 @@
 
 #include "perlin.h"
 #include "rtweekend.h"
+#include "stb-master\\stb_image.h"
+#include "stb-master\\stb_image_resize.h"
+#include "stb-master\\stb_dxt.h"
+#include <algorithm>
+#include <vector>
 
 class texture
 {
 public:
     virtual vec3 value(double u, double v, const vec3 &p) const = 0;
+
+    // Lookup averaged over a du x dv footprint in uv space. Textures without
+    // prefiltered data ignore the footprint.
+    virtual vec3 filtered_value(double u, double v, const vec3 &p, double du, double dv) const
+    {
+        return value(u, v, p);
+    }
 };
 
 class constant_texture : public texture
@@ -33,13 +45,18 @@ public:
 
     virtual vec3 value(double u, double v, const vec3 &p) const
     {
-        auto sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
-        if (sines < 0)
+        if (is_odd(p))
             return odd->value(u, v, p);
         else
             return even->value(u, v, p);
     }
 
+    static bool is_odd(const vec3 &p)
+    {
+        auto sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
+        return sines < 0;
+    }
+
 public:
     shared_ptr<texture> odd;
     shared_ptr<texture> even;
@@ -49,7 +66,7 @@ class noise_texture : public texture
 {
 public:
     noise_texture() {}
-    noise_texture(double sc) : scale(sc) {}
+    noise_texture(double sc, uint32_t seed = 0) : noise(seed), scale(sc) {}
 
     virtual vec3 value(double u, double v, const vec3 &p) const
     {
@@ -62,46 +79,257 @@ public:
     double scale = 1;
 };
 
+// How image_texture keeps its texels in memory. rgb_float is 12 bytes per
+// texel in row-major order; rgb_float_tiled stores the same texels in 32x32
+// blocks (12 KB, three pages) laid out row by row, with the texels inside a
+// block ordered along a Z-curve, so a bilinear footprint and nearby lookups
+// share cache lines and pages; bc1 is DXT1 blocks (8 bytes per 4x4 texels)
+// encoded with stb_dxt and decoded per texel on lookup.
+enum class texture_format
+{
+    rgb_float,
+    rgb_float_tiled,
+    bc1
+};
+
+// Image converted once at load into a float mip pyramid (built with
+// stb_image_resize), looked up bilinearly within a level and trilinearly across
+// levels chosen from the ray footprint.
 class image_texture : public texture
 {
 public:
+    struct mip_level
+    {
+        int nx, ny;
+        std::vector<float> texels;         // rgb, top row first, row-major or Z-ordered blocks
+        std::vector<unsigned char> blocks; // bc1, row-major 4x4 blocks
+    };
+
     image_texture() {}
-    image_texture(unsigned char *pixels, int A, int B)
-        : data(pixels), nx(A), ny(B) {}
 
-    ~image_texture()
+    // Takes ownership of 8-bit rgb pixels from stbi_load. A failed load (null
+    // pixels) gives an empty 0x0 texture whatever the sizes passed.
+    image_texture(unsigned char *pixels, int A, int B, texture_format fmt = texture_format::rgb_float)
+        : nx(pixels ? A : 0), ny(pixels ? B : 0), format(fmt)
     {
-        delete data;
+        if (pixels == nullptr)
+            return;
+
+        std::vector<float> texels(size_t(3) * A * B);
+        for (size_t k = 0; k < texels.size(); k++)
+            texels[k] = pixels[k] / 255.0f;
+        stbi_image_free(pixels);
+        build(std::move(texels));
+    }
+
+    // Linear float rgb texels, row-major, top row first.
+    image_texture(std::vector<float> texels, int A, int B, texture_format fmt = texture_format::rgb_float)
+        : nx(A), ny(B), format(fmt)
+    {
+        build(std::move(texels));
     }
 
     virtual vec3 value(double u, double v, const vec3 &p) const
     {
         // If we have no texture data, then always emit cyan (as a debugging aid).
-        if (data == nullptr)
+        if (levels.empty())
             return vec3(0, 1, 1);
 
-        auto i = static_cast<int>((u)*nx);
-        auto j = static_cast<int>((1 - v) * ny - 0.001);
+        return bilinear(levels[0], u, v);
+    }
+
+    virtual vec3 filtered_value(double u, double v, const vec3 &p, double du, double dv) const
+    {
+        if (levels.empty())
+            return vec3(0, 1, 1);
+
+        auto texels = ffmax(du * nx, dv * ny);
+        if (!(texels > 1))
+            return bilinear(levels[0], u, v);
+
+        auto lod = ffmin(log2(texels), double(levels.size() - 1));
+        int l = static_cast<int>(lod);
+        if (l + 1 >= int(levels.size()))
+            return bilinear(levels[l], u, v);
+
+        auto t = lod - l;
+        return (1 - t) * bilinear(levels[l], u, v) + t * bilinear(levels[l + 1], u, v);
+    }
+
+    size_t memory_bytes() const
+    {
+        size_t bytes = sizeof(*this);
+        for (const auto &level : levels)
+            bytes += level.texels.capacity() * sizeof(float) + level.blocks.capacity();
+        return bytes;
+    }
+
+private:
+    void build(std::vector<float> texels)
+    {
+        levels.push_back(mip_level{nx, ny, std::move(texels), {}});
+        while (levels.back().nx > 1 || levels.back().ny > 1)
+        {
+            const auto &prev = levels.back();
+            mip_level next = {std::max(prev.nx / 2, 1), std::max(prev.ny / 2, 1), {}, {}};
+            next.texels.resize(size_t(3) * next.nx * next.ny);
+            stbir_resize_float(prev.texels.data(), prev.nx, prev.ny, 0,
+                               next.texels.data(), next.nx, next.ny, 0, 3);
+            levels.push_back(std::move(next));
+        }
+
+        if (format == texture_format::rgb_float_tiled)
+            for (auto &level : levels)
+                swizzle_tiles(level);
+        if (format == texture_format::bc1)
+            for (auto &level : levels)
+                compress_bc1(level);
+    }
+
+    vec3 bilinear(const mip_level &level, double u, double v) const
+    {
+        auto x = clamp(u, 0.0, 1.0) * level.nx - 0.5;
+        auto y = (1 - clamp(v, 0.0, 1.0)) * level.ny - 0.5;
+        int i = static_cast<int>(floor(x));
+        int j = static_cast<int>(floor(y));
+        auto fx = float(x - i);
+        auto fy = float(y - j);
+
+        int i0 = std::max(i, 0), i1 = std::min(i + 1, level.nx - 1);
+        int j0 = std::max(j, 0), j1 = std::min(j + 1, level.ny - 1);
+
+        const float *t00, *t10, *t01, *t11;
+        float decoded[4][3];
+        if (format == texture_format::rgb_float_tiled)
+        {
+            t00 = tiled_texel(level, i0, j0);
+            if (!(i0 & 1) && !(j0 & 1) && i1 == i0 + 1 && j1 == j0 + 1)
+            {
+                // An aligned 2x2 quad is four consecutive texels on the Z-curve.
+                t10 = t00 + 3;
+                t01 = t00 + 6;
+                t11 = t00 + 9;
+            }
+            else
+            {
+                t10 = tiled_texel(level, i1, j0);
+                t01 = tiled_texel(level, i0, j1);
+                t11 = tiled_texel(level, i1, j1);
+            }
+        }
+        else if (format == texture_format::bc1)
+        {
+            bc1_texel(level, i0, j0, decoded[0]);
+            bc1_texel(level, i1, j0, decoded[1]);
+            bc1_texel(level, i0, j1, decoded[2]);
+            bc1_texel(level, i1, j1, decoded[3]);
+            t00 = decoded[0];
+            t10 = decoded[1];
+            t01 = decoded[2];
+            t11 = decoded[3];
+        }
+        else
+        {
+            const float *row0 = level.texels.data() + size_t(3) * level.nx * j0;
+            const float *row1 = level.texels.data() + size_t(3) * level.nx * j1;
+            t00 = row0 + 3 * i0;
+            t10 = row0 + 3 * i1;
+            t01 = row1 + 3 * i0;
+            t11 = row1 + 3 * i1;
+        }
+
+        float c[3];
+        for (int k = 0; k < 3; k++)
+        {
+            auto top = t00[k] + fx * (t10[k] - t00[k]);
+            auto bottom = t01[k] + fx * (t11[k] - t01[k]);
+            c[k] = top + fy * (bottom - top);
+        }
+        return vec3(c[0], c[1], c[2]);
+    }
 
-        if (i < 0)
-            i = 0;
-        if (j < 0)
-            j = 0;
-        if (i > nx - 1)
-            i = nx - 1;
-        if (j > ny - 1)
-            j = ny - 1;
+    // Texels are grouped in 32x32 blocks (12 KB, three pages) stored row by
+    // row, and ordered along a Z-curve inside each block.
+    static size_t tiled_index(int blocks_x, int i, int j)
+    {
+        static const uint16_t spread[32] = {0,   1,   4,   5,   16,  17,  20,  21,  64,  65,  68,
+                                            69,  80,  81,  84,  85,  256, 257, 260, 261, 272, 273,
+                                            276, 277, 320, 321, 324, 325, 336, 337, 340, 341};
+        size_t block = size_t(blocks_x) * (j >> 5) + (i >> 5);
+        return 3 * (1024 * block + (spread[i & 31] | (spread[j & 31] << 1)));
+    }
+
+    static const float *tiled_texel(const mip_level &level, int i, int j)
+    {
+        return &level.texels[tiled_index((level.nx + 31) >> 5, i, j)];
+    }
+
+    // Reorders a row-major level into Z-ordered blocks, padding partial blocks.
+    static void swizzle_tiles(mip_level &level)
+    {
+        int blocks_x = (level.nx + 31) / 32, blocks_y = (level.ny + 31) / 32;
+        std::vector<float> tiled(size_t(3072) * blocks_x * blocks_y);
+        for (int j = 0; j < 32 * blocks_y; j++)
+            for (int i = 0; i < 32 * blocks_x; i++)
+            {
+                const float *t = &level.texels[size_t(3) * (size_t(level.nx) * std::min(j, level.ny - 1) +
+                                                            std::min(i, level.nx - 1))];
+                std::copy(t, t + 3, &tiled[tiled_index(blocks_x, i, j)]);
+            }
+        level.texels.swap(tiled);
+    }
+
+    // Encodes a level into bc1 blocks (edge texels replicated into partial
+    // blocks) and drops its float texels.
+    static void compress_bc1(mip_level &level)
+    {
+        int bx = (level.nx + 3) / 4, by = (level.ny + 3) / 4;
+        level.blocks.resize(size_t(8) * bx * by);
+        unsigned char rgba[64];
+        for (int b = 0; b < by; b++)
+            for (int a = 0; a < bx; a++)
+            {
+                for (int y = 0; y < 4; y++)
+                    for (int x = 0; x < 4; x++)
+                    {
+                        int i = std::min(4 * a + x, level.nx - 1);
+                        int j = std::min(4 * b + y, level.ny - 1);
+                        const float *t = &level.texels[size_t(3) * (size_t(level.nx) * j + i)];
+                        unsigned char *out = rgba + 4 * (4 * y + x);
+                        for (int k = 0; k < 3; k++)
+                            out[k] = static_cast<unsigned char>(clamp(t[k], 0.0, 1.0) * 255 + 0.5);
+                        out[3] = 255;
+                    }
+                stb_compress_dxt_block(&level.blocks[size_t(8) * (size_t(bx) * b + a)], rgba, 0, STB_DXT_HIGHQUAL);
+            }
+        std::vector<float>().swap(level.texels);
+    }
+
+    static void bc1_texel(const mip_level &level, int i, int j, float *c)
+    {
+        const unsigned char *block = &level.blocks[size_t(8) * (size_t((level.nx + 3) / 4) * (j / 4) + i / 4)];
+        unsigned c0 = block[0] | (block[1] << 8);
+        unsigned c1 = block[2] | (block[3] << 8);
+        unsigned index = (block[4 + (j & 3)] >> (2 * (i & 3))) & 3;
 
-        auto r = static_cast<int>(data[3 * i + 3 * nx * j + 0]) / 255.0;
-        auto g = static_cast<int>(data[3 * i + 3 * nx * j + 1]) / 255.0;
-        auto b = static_cast<int>(data[3 * i + 3 * nx * j + 2]) / 255.0;
-        //std::cout << r * 255 << ' ' << g * 255 << ' ' << b * 255 << std::endl;
-        return vec3(r, g, b);
+        float e0[3] = {(c0 >> 11) / 31.0f, ((c0 >> 5) & 63) / 63.0f, (c0 & 31) / 31.0f};
+        float e1[3] = {(c1 >> 11) / 31.0f, ((c1 >> 5) & 63) / 63.0f, (c1 & 31) / 31.0f};
+        // Four-colour mode when c0 > c1, otherwise three colours plus black.
+        static const float weights[2][4] = {{0, 1, 0.5f, 0}, {0, 1, 1.0f / 3, 2.0f / 3}};
+        if (c0 <= c1 && index == 3)
+        {
+            c[0] = c[1] = c[2] = 0;
+            return;
+        }
+        float t = weights[c0 > c1][index];
+        for (int k = 0; k < 3; k++)
+            c[k] = e0[k] + t * (e1[k] - e0[k]);
     }
 
 public:
-    unsigned char *data;
-    int nx, ny;
+    std::vector<mip_level> levels;
+    int nx = 0, ny = 0;
+    texture_format format = texture_format::rgb_float;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,124 @@
+//texture_cache.h 纹理资源缓存
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "parallel.h"
+#include "texture.h"
+#include "tiled_texture.h"
+#include "timeline.h"
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// Process-wide cache of decoded image textures keyed by path and storage
+// format. Images are always decoded as 8-bit rgb. Each image is decoded (and its mip pyramid built) once on the shared
+// thread pool, and every material asking for it gets the same image_texture.
+class texture_cache
+{
+public:
+    static texture_cache &instance()
+    {
+        static texture_cache cache;
+        return cache;
+    }
+
+    // Starts decoding in the background if the image is not cached yet. Scenes
+    // prefetch all their images first so the decodes overlap.
+    void prefetch(const std::string &path, texture_format format = texture_format::rgb_float)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto key = std::make_pair(path, format);
+        if (entries.count(key))
+            return;
+
+        entries[key] = thread_pool::shared()
+                           .submit([path, format]() {
+                               timeline_scope scope("decode texture", "load", path);
+                               int nx = 0, ny = 0, nn = 0;
+                               unsigned char *data = stbi_load(path.c_str(), &nx, &ny, &nn, 3);
+                               if (data == nullptr)
+                                   std::cerr << "Could not load texture " << path << ".\n";
+                               return make_shared<image_texture>(data, nx, ny, format);
+                           })
+                           .share();
+    }
+
+    shared_ptr<image_texture> get(const std::string &path, texture_format format = texture_format::rgb_float)
+    {
+        prefetch(path, format);
+        std::shared_future<shared_ptr<image_texture>> entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            entry = entries[std::make_pair(path, format)];
+        }
+        return entry.get();
+    }
+
+    // Out-of-core variant: converts the image to a tiled file next to it
+    // (path + ".tiles") and returns a texture paging through tile_cache. The
+    // file is converted again whenever the image's size or modification time
+    // no longer match the ones recorded in it; without the image, an existing
+    // file is used as is.
+    shared_ptr<tiled_image_texture> get_tiled(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &entry = tiled_entries[path];
+        if (entry)
+            return entry;
+
+        auto tiled_path = path + ".tiles";
+        int64_t source_size, source_mtime;
+        if (stat_source(path, source_size, source_mtime) &&
+            !tiled_texture_current(tiled_path, source_size, source_mtime))
+        {
+            timeline_scope scope("convert to tiles", "load", path);
+            int nx = 0, ny = 0, nn = 0;
+            unsigned char *data = stbi_load(path.c_str(), &nx, &ny, &nn, 3);
+            if (data == nullptr)
+                std::cerr << "Could not load texture " << path << ".\n";
+            else
+            {
+                if (!write_tiled_texture(tiled_path, data, nx, ny, source_size, source_mtime))
+                    std::cerr << "Could not write tiled texture " << tiled_path << ".\n";
+                stbi_image_free(data);
+            }
+        }
+        entry = make_shared<tiled_image_texture>(tiled_path);
+        return entry;
+    }
+
+    size_t memory_bytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t bytes = 0;
+        for (auto &entry : entries)
+            bytes += entry.second.get()->memory_bytes();
+        return bytes;
+    }
+
+    void report(std::ostream &out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t total = 0;
+        for (auto &entry : entries)
+        {
+            const auto &tex = entry.second.get();
+            total += tex->memory_bytes();
+            static const char *format_names[] = {"rgb float", "z-order", "bc1"};
+            out << entry.first.first << " (" << format_names[int(entry.first.second)] << "): "
+                << tex->nx << 'x' << tex->ny << ", " << tex->levels.size() << " levels, "
+                << tex->memory_bytes() / 1024 << " KB, " << tex.use_count() - 1 << " users\n";
+        }
+        out << "Texture cache: " << entries.size() << " images, " << total / 1024 << " KB\n";
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::pair<std::string, texture_format>, std::shared_future<shared_ptr<image_texture>>> entries;
+    std::map<std::string, shared_ptr<tiled_image_texture>> tiled_entries;
+};
+
+#endif
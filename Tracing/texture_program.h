@@ -0,0 +1,137 @@
+//texture_program.h 纹理表达式编译
+#ifndef TEXTURE_PROGRAM_H
+#define TEXTURE_PROGRAM_H
+
+#include "texture.h"
+#include <cstdint>
+#include <typeinfo>
+#include <vector>
+
+// A texture graph compiled into a flat instruction array. Constant leaves
+// become literals, a checker whose branches fold to the same colour becomes
+// that colour, and the known texture classes are called non-virtually. Other
+// textures stay as one opaque instruction evaluated through their virtual
+// interface. The graph is read once at compile time; changing it afterwards
+// does not affect the program.
+class texture_program
+{
+public:
+    enum opcode : uint8_t
+    {
+        op_constant, // color
+        op_checker,  // jump to even or odd
+        op_noise,    // noise_texture
+        op_image,    // image_texture
+        op_texture   // anything else, virtual call
+    };
+
+    struct instruction
+    {
+        opcode op;
+        int even, odd;
+        vec3 color;
+        const texture *tex;
+    };
+
+    texture_program() {}
+    texture_program(const shared_ptr<texture> &root) : source(root)
+    {
+        if (root)
+            emit(root.get());
+    }
+
+    bool is_constant() const
+    {
+        return code.size() == 1 && code[0].op == op_constant;
+    }
+
+    // Same results as root->filtered_value(); checker branches are looked up
+    // unfiltered, as checker_texture does.
+    vec3 filtered_value(double u, double v, const vec3 &p, double du, double dv) const
+    {
+        return run(u, v, p, du, dv, true);
+    }
+
+    vec3 value(double u, double v, const vec3 &p) const
+    {
+        return run(u, v, p, 0, 0, false);
+    }
+
+private:
+    vec3 run(double u, double v, const vec3 &p, double du, double dv, bool filtered) const
+    {
+        int pc = 0;
+        for (;;)
+        {
+            const auto &in = code[pc];
+            switch (in.op)
+            {
+            case op_constant:
+                return in.color;
+            case op_checker:
+                pc = checker_texture::is_odd(p) ? in.odd : in.even;
+                filtered = false;
+                break;
+            case op_noise:
+                return static_cast<const noise_texture *>(in.tex)->noise_texture::value(u, v, p);
+            case op_image:
+                if (filtered)
+                    return static_cast<const image_texture *>(in.tex)->image_texture::filtered_value(u, v, p, du, dv);
+                return static_cast<const image_texture *>(in.tex)->image_texture::value(u, v, p);
+            default:
+                return filtered ? in.tex->filtered_value(u, v, p, du, dv) : in.tex->value(u, v, p);
+            }
+        }
+    }
+
+    int emit(const texture *t)
+    {
+        int at = int(code.size());
+        code.push_back(instruction{op_texture, 0, 0, vec3(), t});
+
+        // A checker built without one of its branches: the program then fails
+        // on the same lookups as checker_texture does, not at compile time.
+        if (!t)
+            return at;
+
+        // Exact type matches only: a subclass may override value().
+        const auto &type = typeid(*t);
+        if (type == typeid(constant_texture))
+        {
+            code[at].op = op_constant;
+            code[at].color = static_cast<const constant_texture *>(t)->color;
+        }
+        else if (type == typeid(checker_texture))
+        {
+            auto checker = static_cast<const checker_texture *>(t);
+            int even = emit(checker->even.get());
+            int odd = emit(checker->odd.get());
+            const auto &a = code[even].color, &b = code[odd].color;
+            if (code[even].op == op_constant && code[odd].op == op_constant &&
+                a.x() == b.x() && a.y() == b.y() && a.z() == b.z())
+            {
+                auto color = code[even].color;
+                code.resize(at + 1);
+                code[at].op = op_constant;
+                code[at].color = color;
+            }
+            else
+            {
+                code[at].op = op_checker;
+                code[at].even = even;
+                code[at].odd = odd;
+            }
+        }
+        else if (type == typeid(noise_texture))
+            code[at].op = op_noise;
+        else if (type == typeid(image_texture))
+            code[at].op = op_image;
+        return at;
+    }
+
+public:
+    std::vector<instruction> code;
+    shared_ptr<texture> source; // keeps the referenced textures alive
+};
+
+#endif
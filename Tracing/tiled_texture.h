@@ -0,0 +1,456 @@
+//tiled_texture.h 分块纹理与 LRU 分页缓存
+#ifndef TILED_TEXTURE_H
+#define TILED_TEXTURE_H
+
+#include "texture.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// On-disk layout of a tiled texture: a header, the size of every mip level,
+// then each level's tiles in row-major order. Every tile holds
+// tile_size x tile_size float rgb texels (edge tiles replicate the last
+// row/column), so a tile's offset follows from its coordinates. The header
+// records the size and modification time of the source image, so a file left
+// from an older version of the image is recognised as stale.
+struct tiled_texture_header
+{
+    char magic[4] = {'R', 'T', 'T', 'X'};
+    int32_t version = 2;
+    int32_t nx = 0, ny = 0;
+    int32_t tile_size = 0;
+    int32_t level_count = 0;
+    int64_t source_size = 0;
+    int64_t source_mtime = 0;
+};
+
+// Size and modification time of a source image; false if it cannot be read.
+inline bool stat_source(const std::string &path, int64_t &size, int64_t &mtime)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return false;
+    size = int64_t(info.st_size);
+    mtime = int64_t(info.st_mtime);
+    return true;
+}
+
+// True if path is a tiled texture file converted from the source image with
+// the given size and modification time.
+inline bool tiled_texture_current(const std::string &path, int64_t source_size, int64_t source_mtime)
+{
+    std::ifstream file(path, std::ios::binary);
+    tiled_texture_header header;
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    return file && std::string(header.magic, 4) == "RTTX" && header.version == tiled_texture_header().version &&
+           header.source_size == source_size && header.source_mtime == source_mtime;
+}
+
+// Writes one mip level's tiles; texel(i, j, k) gives channel k of texel (i, j).
+template <typename Texel>
+void write_level_tiles(std::ostream &out, int nx, int ny, int tile_size, Texel texel)
+{
+    std::vector<float> tile(size_t(3) * tile_size * tile_size);
+    int tiles_x = (nx + tile_size - 1) / tile_size;
+    int tiles_y = (ny + tile_size - 1) / tile_size;
+    for (int ty = 0; ty < tiles_y; ty++)
+        for (int tx = 0; tx < tiles_x; tx++)
+        {
+            for (int y = 0; y < tile_size; y++)
+                for (int x = 0; x < tile_size; x++)
+                {
+                    int i = std::min(tx * tile_size + x, nx - 1);
+                    int j = std::min(ty * tile_size + y, ny - 1);
+                    for (int k = 0; k < 3; k++)
+                        tile[size_t(3) * (y * tile_size + x) + k] = texel(i, j, k);
+                }
+            out.write(reinterpret_cast<const char *>(tile.data()), tile.size() * sizeof(float));
+        }
+}
+
+// The next mip level of an nx x ny level, each texel the mean of the 2x2
+// texels it covers (edges clamped).
+template <typename Texel>
+std::vector<float> box_downsample(int nx, int ny, int next_nx, int next_ny, Texel texel)
+{
+    std::vector<float> next(size_t(3) * next_nx * next_ny);
+    for (int j = 0; j < next_ny; j++)
+        for (int i = 0; i < next_nx; i++)
+        {
+            int i0 = std::min(2 * i, nx - 1), i1 = std::min(2 * i + 1, nx - 1);
+            int j0 = std::min(2 * j, ny - 1), j1 = std::min(2 * j + 1, ny - 1);
+            for (int k = 0; k < 3; k++)
+                next[size_t(3) * (size_t(next_nx) * j + i) + k] =
+                    0.25f * (texel(i0, j0, k) + texel(i1, j0, k) + texel(i0, j1, k) + texel(i1, j1, k));
+        }
+    return next;
+}
+
+// Converts 8-bit rgb pixels from stbi_load (row-major, top row first) into a
+// tiled texture file, stamped with the source image's size and modification
+// time. The conversion runs one mip level at a time: level 0 is tiled straight
+// from the pixels and every further level is box filtered from the one before
+// and dropped once the next exists. Besides the pixels, at most two float
+// levels are held, the larger a quarter of the image, so the conversion peaks
+// at about twice the 8-bit image rather than building the whole float pyramid
+// (over five times it). The levels therefore use a 2x2 box filter, not
+// image_texture's stb_image_resize filter. The file is written under a
+// temporary name and renamed into place once complete, so an interrupted
+// conversion never leaves a truncated file under the final name.
+bool write_tiled_texture(const std::string &path, const unsigned char *pixels, int nx, int ny,
+                         int64_t source_size, int64_t source_mtime, int tile_size = 64)
+{
+    if (pixels == nullptr || nx <= 0 || ny <= 0)
+        return false;
+
+    std::vector<std::pair<int, int>> sizes(1, std::make_pair(nx, ny));
+    while (sizes.back().first > 1 || sizes.back().second > 1)
+        sizes.push_back(std::make_pair(std::max(sizes.back().first / 2, 1), std::max(sizes.back().second / 2, 1)));
+
+    auto temp_path = path + ".tmp";
+    std::ofstream out(temp_path, std::ios::binary);
+    tiled_texture_header header;
+    header.nx = nx;
+    header.ny = ny;
+    header.tile_size = tile_size;
+    header.level_count = int32_t(sizes.size());
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const auto &size : sizes)
+    {
+        int32_t level_size[2] = {size.first, size.second};
+        out.write(reinterpret_cast<const char *>(level_size), sizeof(level_size));
+    }
+
+    auto pixel = [&](int i, int j, int k) { return pixels[size_t(3) * (size_t(nx) * j + i) + k] / 255.0f; };
+    write_level_tiles(out, nx, ny, tile_size, pixel);
+
+    std::vector<float> level;
+    for (size_t l = 1; l < sizes.size() && out; l++)
+    {
+        int prev_nx = sizes[l - 1].first, prev_ny = sizes[l - 1].second;
+        int next_nx = sizes[l].first, next_ny = sizes[l].second;
+        if (l == 1)
+            level = box_downsample(prev_nx, prev_ny, next_nx, next_ny, pixel);
+        else
+            level = box_downsample(prev_nx, prev_ny, next_nx, next_ny, [&](int i, int j, int k) {
+                return level[size_t(3) * (size_t(prev_nx) * j + i) + k];
+            });
+        write_level_tiles(out, next_nx, next_ny, tile_size,
+                          [&](int i, int j, int k) { return level[size_t(3) * (size_t(next_nx) * j + i) + k]; });
+    }
+
+    out.close();
+    if (!out)
+    {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    std::remove(path.c_str()); // rename does not replace on Windows
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+// Process-wide cache of texture tiles with a memory budget. The least recently
+// used tiles are evicted once the resident size exceeds the budget; tiles still
+// held by a lookup stay alive through their shared_ptr. Disk reads happen
+// outside the cache lock. A load that returns null is passed on uncached.
+// Each thread keeps the last tile it fetched and checks it before taking the
+// lock, since neighbouring lookups nearly always land in the same tile; such a
+// hit does not refresh the tile's LRU position, and the slot can keep one
+// evicted tile per thread alive past the budget.
+class tile_cache
+{
+public:
+    struct tile
+    {
+        std::vector<float> texels;
+    };
+
+    static tile_cache &instance()
+    {
+        static tile_cache cache;
+        return cache;
+    }
+
+    void set_budget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    template <typename Load>
+    std::shared_ptr<const tile> fetch(uint64_t key, Load load)
+    {
+        auto &last = last_fetched();
+        if (last.data && last.key == key)
+        {
+            hits++;
+            return last.data;
+        }
+        last.data = locked_fetch(key, load);
+        last.key = key;
+        return last.data;
+    }
+
+    void report(std::ostream &out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t lookups = hits + misses;
+        out << "Tile cache: " << hits << " hits, " << misses << " misses ("
+            << (lookups ? 100.0 * hits / lookups : 0.0) << "% hit rate), " << evictions << " evictions, "
+            << bytes_read / (1024 * 1024) << " MB read, " << resident / 1024 << " KB resident (peak "
+            << peak_resident / 1024 << " KB, budget " << budget / 1024 << " KB)\n";
+    }
+
+    std::atomic<uint64_t> hits{0}, misses{0}, bytes_read{0};
+    uint64_t evictions = 0;
+
+private:
+    struct slot
+    {
+        uint64_t key = 0;
+        std::shared_ptr<const tile> data;
+    };
+
+    static slot &last_fetched()
+    {
+        thread_local slot s;
+        return s;
+    }
+
+    template <typename Load>
+    std::shared_ptr<const tile> locked_fetch(uint64_t key, Load &load)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(key);
+            if (it != entries.end())
+            {
+                lru.splice(lru.begin(), lru, it->second);
+                hits++;
+                return it->second->second;
+            }
+        }
+
+        std::shared_ptr<const tile> loaded = load();
+        misses++;
+        if (!loaded)
+            return loaded; // a failed read is not cached, so it is retried
+        bytes_read += loaded->texels.size() * sizeof(float);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end())
+            return it->second->second; // another thread loaded it meanwhile
+
+        lru.emplace_front(key, loaded);
+        entries[key] = lru.begin();
+        resident += loaded->texels.size() * sizeof(float);
+        peak_resident = std::max(peak_resident, resident);
+        evict();
+        return loaded;
+    }
+
+    void evict()
+    {
+        while (resident > budget && lru.size() > 1)
+        {
+            resident -= lru.back().second->texels.size() * sizeof(float);
+            entries.erase(lru.back().first);
+            lru.pop_back();
+            evictions++;
+        }
+    }
+
+    typedef std::list<std::pair<uint64_t, std::shared_ptr<const tile>>> lru_list;
+
+    std::mutex mutex;
+    lru_list lru;
+    std::unordered_map<uint64_t, lru_list::iterator> entries;
+    size_t budget = size_t(256) << 20;
+    size_t resident = 0;
+    size_t peak_resident = 0;
+};
+
+// Image texture backed by a tiled texture file. Only the header stays in
+// memory; texels are paged in through tile_cache on demand. Lookups match
+// image_texture: bilinear within a level, trilinear across levels.
+class tiled_image_texture : public texture
+{
+public:
+    struct level_info
+    {
+        int nx, ny, tiles_x, tiles_y;
+        std::streamoff offset;
+    };
+
+    // A file with a bad header, bad level sizes or fewer bytes than its
+    // tiles need is rejected as a whole; the texture then renders cyan.
+    tiled_image_texture(const std::string &path) : file(path, std::ios::binary), id(next_id())
+    {
+        tiled_texture_header header;
+        file.read(reinterpret_cast<char *>(&header), sizeof(header));
+        if (!file || std::string(header.magic, 4) != "RTTX" || header.version != tiled_texture_header().version ||
+            header.nx <= 0 || header.ny <= 0 || header.tile_size <= 0 || header.tile_size > 4096 ||
+            header.level_count <= 0 || header.level_count > 32)
+        {
+            std::cerr << "Could not open tiled texture " << path << ".\n";
+            return;
+        }
+
+        tile_size = header.tile_size;
+        std::streamoff offset = sizeof(header) + header.level_count * 2 * sizeof(int32_t);
+        for (int l = 0; l < header.level_count; l++)
+        {
+            int32_t size[2];
+            file.read(reinterpret_cast<char *>(size), sizeof(size));
+            if (!file || size[0] <= 0 || size[1] <= 0 || size[0] > header.nx || size[1] > header.ny)
+            {
+                std::cerr << "Bad level sizes in tiled texture " << path << ".\n";
+                levels.clear();
+                return;
+            }
+            level_info level = {size[0], size[1], (size[0] + tile_size - 1) / tile_size,
+                                (size[1] + tile_size - 1) / tile_size, offset};
+            offset += std::streamoff(level.tiles_x) * level.tiles_y * tile_bytes();
+            levels.push_back(level);
+        }
+
+        file.seekg(0, std::ios::end);
+        if (file.tellg() < offset)
+        {
+            std::cerr << "Tiled texture " << path << " is truncated.\n";
+            levels.clear();
+            return;
+        }
+        nx = header.nx;
+        ny = header.ny;
+    }
+
+    virtual vec3 value(double u, double v, const vec3 &p) const
+    {
+        if (levels.empty())
+            return vec3(0, 1, 1);
+
+        return bilinear(0, u, v);
+    }
+
+    virtual vec3 filtered_value(double u, double v, const vec3 &p, double du, double dv) const
+    {
+        if (levels.empty())
+            return vec3(0, 1, 1);
+
+        auto texels = ffmax(du * nx, dv * ny);
+        if (!(texels > 1))
+            return bilinear(0, u, v);
+
+        auto lod = ffmin(log2(texels), double(levels.size() - 1));
+        int l = static_cast<int>(lod);
+        if (l + 1 >= int(levels.size()))
+            return bilinear(l, u, v);
+
+        auto t = lod - l;
+        return (1 - t) * bilinear(l, u, v) + t * bilinear(l + 1, u, v);
+    }
+
+private:
+    static uint32_t next_id()
+    {
+        static std::atomic<uint32_t> counter(0);
+        return counter++;
+    }
+
+    size_t tile_bytes() const
+    {
+        return size_t(3) * tile_size * tile_size * sizeof(float);
+    }
+
+    std::shared_ptr<const tile_cache::tile> fetch_tile(int l, int tx, int ty) const
+    {
+        uint64_t key = (uint64_t(id) << 44) | (uint64_t(l) << 36) | (uint64_t(ty) << 18) | uint64_t(tx);
+        return tile_cache::instance().fetch(key, [&]() {
+            timeline_scope scope("read tile", "io", l);
+            auto loaded = std::make_shared<tile_cache::tile>();
+            loaded->texels.resize(tile_bytes() / sizeof(float));
+            const auto &level = levels[l];
+            std::lock_guard<std::mutex> lock(file_mutex);
+            file.seekg(level.offset + std::streamoff(size_t(ty) * level.tiles_x + tx) * tile_bytes());
+            file.read(reinterpret_cast<char *>(loaded->texels.data()), tile_bytes());
+            if (!file || file.gcount() != std::streamsize(tile_bytes()))
+            {
+                file.clear();
+                if (!read_failed.exchange(true))
+                    std::cerr << "Could not read a tile of a tiled texture; it renders cyan.\n";
+                loaded.reset();
+            }
+            return std::shared_ptr<const tile_cache::tile>(loaded);
+        });
+    }
+
+    vec3 bilinear(int l, double u, double v) const
+    {
+        const auto &level = levels[l];
+        auto x = clamp(u, 0.0, 1.0) * level.nx - 0.5;
+        auto y = (1 - clamp(v, 0.0, 1.0)) * level.ny - 0.5;
+        int i = static_cast<int>(floor(x));
+        int j = static_cast<int>(floor(y));
+        auto fx = float(x - i);
+        auto fy = float(y - j);
+
+        int is[2] = {std::max(i, 0), std::min(i + 1, level.nx - 1)};
+        int js[2] = {std::max(j, 0), std::min(j + 1, level.ny - 1)};
+
+        // The four taps usually share a tile, so only fetch when it changes.
+        float c[2][2][3];
+        std::shared_ptr<const tile_cache::tile> current;
+        int current_tx = -1, current_ty = -1;
+        for (int b = 0; b < 2; b++)
+            for (int a = 0; a < 2; a++)
+            {
+                int tx = is[a] / tile_size, ty = js[b] / tile_size;
+                if (tx != current_tx || ty != current_ty)
+                {
+                    current = fetch_tile(l, tx, ty);
+                    current_tx = tx;
+                    current_ty = ty;
+                    if (!current)
+                        return vec3(0, 1, 1);
+                }
+                const float *t = &current->texels[size_t(3) * ((js[b] % tile_size) * tile_size + is[a] % tile_size)];
+                std::copy(t, t + 3, c[b][a]);
+            }
+
+        float result[3];
+        for (int k = 0; k < 3; k++)
+        {
+            auto top = c[0][0][k] + fx * (c[0][1][k] - c[0][0][k]);
+            auto bottom = c[1][0][k] + fx * (c[1][1][k] - c[1][0][k]);
+            result[k] = top + fy * (bottom - top);
+        }
+        return vec3(result[0], result[1], result[2]);
+    }
+
+public:
+    std::vector<level_info> levels;
+    int nx = 0, ny = 0, tile_size = 0;
+
+private:
+    mutable std::ifstream file;
+    mutable std::mutex file_mutex;
+    mutable std::atomic<bool> read_failed{false}; // reported once
+    uint32_t id;
+};
+
+#endif
@@ -0,0 +1,163 @@
+//timeline.h 渲染时间线 (Chrome trace-event 格式)
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process-wide recorder of timed events (scene build, texture decodes, BVH
+// build, render rows per thread, tile reads, image output), written in the
+// Chrome trace-event format for chrome://tracing or Perfetto. Recording is
+// off until enable(); a disabled timeline_scope costs one branch.
+class timeline
+{
+public:
+    struct event
+    {
+        const char *name;
+        const char *category;
+        double start_us, duration_us;
+        int thread;
+        int index;          // args.index when >= 0
+        std::string detail; // args.detail when not empty
+    };
+
+    static timeline &instance()
+    {
+        static timeline t;
+        return t;
+    }
+
+    void enable()
+    {
+        origin = std::chrono::steady_clock::now();
+        enabled = true;
+    }
+
+    double now_us() const
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    // Small stable id per thread, in order of first use.
+    static int thread_id()
+    {
+        static std::atomic<int> next(0);
+        thread_local int id = next++;
+        return id;
+    }
+
+    void record(event e)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back(std::move(e));
+    }
+
+    bool write(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ofstream out(path);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        int threads = 0;
+        for (const auto &e : events)
+            threads = std::max(threads, e.thread + 1);
+        for (int t = 0; t < threads; t++)
+            out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t
+                << ", \"args\": {\"name\": \"" << (t ? "thread " + std::to_string(t) : std::string("main"))
+                << "\"}},\n";
+        for (size_t k = 0; k < events.size(); k++)
+        {
+            const auto &e = events[k];
+            out << "{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category << "\", \"ph\": \"X\", \"ts\": "
+                << e.start_us << ", \"dur\": " << e.duration_us << ", \"pid\": 1, \"tid\": " << e.thread;
+            if (e.index >= 0 || !e.detail.empty())
+            {
+                out << ", \"args\": {";
+                if (e.index >= 0)
+                    out << "\"index\": " << e.index << (e.detail.empty() ? "" : ", ");
+                if (!e.detail.empty())
+                    out << "\"detail\": \"" << escaped(e.detail) << "\"";
+                out << "}";
+            }
+            out << "}" << (k + 1 < events.size() ? "," : "") << "\n";
+        }
+        out << "]}\n";
+        return bool(out);
+    }
+
+    bool enabled = false;
+
+private:
+    static std::string escaped(const std::string &s)
+    {
+        std::string out;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            out += c;
+        }
+        return out;
+    }
+
+    std::chrono::steady_clock::time_point origin;
+    std::mutex mutex;
+    std::vector<event> events;
+};
+
+// Records the enclosing block as one complete event on the calling thread.
+class timeline_scope
+{
+public:
+    timeline_scope(const char *name, const char *category, int index = -1, std::string detail = std::string())
+        : active(timeline::instance().enabled)
+    {
+        if (active)
+            e = {name, category, timeline::instance().now_us(), 0, timeline::thread_id(), index, std::move(detail)};
+    }
+
+    timeline_scope(const char *name, const char *category, std::string detail)
+        : timeline_scope(name, category, -1, std::move(detail)) {}
+
+    ~timeline_scope()
+    {
+        if (active)
+        {
+            e.duration_us = timeline::instance().now_us() - e.start_us;
+            timeline::instance().record(std::move(e));
+        }
+    }
+
+private:
+    bool active;
+    timeline::event e;
+};
+
+// Enables the timeline for a non-empty path and writes it there when the
+// guard goes out of scope, so every return from main leaves a trace.
+class timeline_output
+{
+public:
+    explicit timeline_output(std::string path) : path(std::move(path))
+    {
+        if (!this->path.empty())
+            timeline::instance().enable();
+    }
+
+    ~timeline_output()
+    {
+        if (!path.empty() && !timeline::instance().write(path))
+            std::cerr << "\nCould not write " << path << "\n";
+    }
+
+private:
+    std::string path;
+};
+
+#endif
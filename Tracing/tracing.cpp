@@ -1,47 +1,384 @@
 //main.cc
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 #include "rtweekend.h"
 #define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#define STB_DXT_IMPLEMENTATION
+#include "attribution.h"
+#include "baked_texture.h"
 #include "bvh.h"
+#include "bvh_quality.h"
 #include "camera.h"
+#include "denoise.h"
+#include "flatten.h"
+#include "framebuffer.h"
+#include "heatmap.h"
 #include "hittable_list.h"
+#include "instance.h"
 #include "material.h"
+#include "parallel.h"
+#include "sampler.h"
+#include "scene.h"
+#include "scene_memory.h"
 #include "sphere.h"
-#include "stb-master\\stb_image.h"
+#include "texture_cache.h"
+#include "timeline.h"
 #include "trans.h"
+#include "volume.h"
+#include <chrono>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 #include <iostream>
 #include <malloc.h>
+#include <vector>
 using namespace std;
 
-vec3 ray_color(const ray &r, const vec3 &background, const hittable &world, int depth)
+// Rays traced (world.hit calls) by the current thread.
+thread_local long long rays_traced = 0;
+
+// features, when given, receives the first-hit albedo, normal, depth, emission
+// and material ID.
+vec3 ray_color(const ray &r, const vec3 &background, const scene_root &world, int depth,
+               feature_sample *features = nullptr)
 {
     hit_record rec;
 
     // If we've exceeded the ray bounce limit, no more light is gathered.
     if (depth <= 0)
+    {
+        STAT(thread_stats().paths_depth_limit++);
         return vec3(0, 0, 0);
+    }
+
+    ++rays_traced;
+    STAT(thread_stats().count_ray(depth));
 
     // If the ray hits nothing, return the background color.
     if (!world.hit(r, 0.001, infinity, rec))
+    {
+        STAT(thread_stats().paths_escaped++);
+        if (features)
+            *features = {vec3(1, 1, 1), vec3(0, 0, 0), infinity, background, -1};
         return background;
+    }
 
     ray scattered;
     vec3 attenuation;
-    vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) //如果返回false认为被吸收
+    vec3 emitted;
+    bool scatters;
+    {
+        shading_scope<material> shading(*rec.mat_ptr);
+        emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        rec.footprint = r.cone_width + r.cone_spread * rec.t * r.direction().length();
+        scatters = rec.mat_ptr->scatter(r, rec, attenuation, scattered);
+    }
+    if (features)
+        *features = {scatters ? attenuation : vec3(1, 1, 1), rec.normal, rec.t * r.direction().length(),
+                     emitted, rec.mat_ptr->id};
+    if (!scatters) //如果返回false认为被吸收
+    {
+        STAT(thread_stats().paths_absorbed++);
         return emitted;
+    }
+
+    // Continue the ray cone from the hit; keeping the incoming spread is the
+    // specular approximation, which errs towards sharper (finer) mip levels.
+    scattered.cone_width = rec.footprint;
+    scattered.cone_spread = r.cone_spread;
 
     return emitted + attenuation * ray_color(scattered, background, world, depth - 1);
 }
 
-hittable_list earth()
+// Sums spp samples of pixel (i, j). With a sampler, every random_double() on
+// the path (pixel jitter, lens, time, bounces, media) draws the next Sobol
+// dimension; without one it falls back to the per-thread random stream.
+// fb, when given, receives the pixel's average colour and all of its AOVs.
+vec3 render_pixel(int i, int j, int spp, sampler *smp, camera &cam, const vec3 &background,
+                  const scene_root &world, int image_width, int image_height, int max_depth,
+                  framebuffer *fb = nullptr)
+{
+    active_sampler = smp;
+    if (smp)
+        smp->start_pixel(i, j);
+    STAT(thread_stats().depth_limit = max_depth);
+
+    vec3 color(0, 0, 0);
+    feature_sample sum = {vec3(0, 0, 0), vec3(0, 0, 0), 0, vec3(0, 0, 0), -1};
+    double lum_sum = 0, lum_sq_sum = 0;
+    for (int s = 0; s < spp; ++s)
+    {
+        if (smp)
+            smp->start_sample(s);
+        double du, dv;
+        random_double2(du, dv);
+        auto u = (i + du) / image_width;
+        auto v = (j + dv) / image_height;
+        ray r = cam.get_ray(u, v);
+        feature_sample f;
+        vec3 sample = ray_color(r, background, world, max_depth, fb ? &f : nullptr);
+        color += sample;
+        if (fb)
+        {
+            sum.albedo += f.albedo;
+            sum.normal += f.normal;
+            sum.depth += ffmin(f.depth, 1e8);
+            sum.emission += f.emission;
+            if (s == 0)
+                sum.material_id = f.material_id;
+            auto lum = 0.2126 * sample.x() + 0.7152 * sample.y() + 0.0722 * sample.z();
+            lum_sum += lum;
+            lum_sq_sum += lum * lum;
+        }
+    }
+
+    if (fb)
+    {
+        auto p = fb->index(i, j);
+        auto mean = lum_sum / spp;
+        fb->color[p] = color / spp;
+        fb->albedo[p] = sum.albedo / spp;
+        fb->normal[p] = sum.normal / spp;
+        fb->depth[p] = sum.depth / spp;
+        fb->emission[p] = sum.emission / spp;
+        fb->material_id[p] = sum.material_id;
+        fb->sample_count[p] = spp;
+        fb->variance[p] = spp > 1 ? (lum_sq_sum - spp * mean * mean) / (spp - 1) / spp : 0;
+    }
+    active_sampler = nullptr;
+    return color;
+}
+
+// Prints RMS error against a high-spp reference for random and Sobol sampling
+// at power-of-two spp on a crop in the middle of the frame.
+void convergence_study(camera &cam, const vec3 &background, const scene_root &world,
+                       int image_width, int image_height, int max_depth)
+{
+    const int crop = 32;
+    const int reference_spp = 4096;
+    const int max_spp = 256;
+    const int x0 = (image_width - crop) / 2;
+    const int y0 = (image_height - crop) / 2;
+
+    auto render_crop = [&](sampler *smp, int spp) {
+        vector<vec3> out;
+        for (int j = y0; j < y0 + crop; ++j)
+            for (int i = x0; i < x0 + crop; ++i)
+                out.push_back(render_pixel(i, j, spp, smp, cam, background, world,
+                                           image_width, image_height, max_depth) /
+                              spp);
+        return out;
+    };
+
+    auto rmse = [](const vector<vec3> &a, const vector<vec3> &b) {
+        double sum = 0;
+        for (size_t k = 0; k < a.size(); ++k)
+            sum += (a[k] - b[k]).length_squared() / 3;
+        return sqrt(sum / a.size());
+    };
+
+    sampler reference_sampler(0x5eed);
+    auto reference = render_crop(&reference_sampler, reference_spp);
+
+    cout << "spp rmse_random rmse_sobol\n";
+    for (int spp = 1; spp <= max_spp; spp *= 2)
+    {
+        sampler sobol_sampler(1);
+        auto random_err = rmse(render_crop(nullptr, spp), reference);
+        auto sobol_err = rmse(render_crop(&sobol_sampler, spp), reference);
+        cout << spp << ' ' << random_err << ' ' << sobol_err << '\n';
+    }
+}
+
+// Times scalar and SIMD turbulence on the same random points and checks they
+// agree.
+void noise_benchmark()
+{
+    const int count = 1 << 20;
+    perlin noise;
+    vector<vec3> points(count);
+    for (auto &p : points)
+        p = vec3::random(-100, 100);
+
+    auto time_turb = [&](bool reference, double &checksum) {
+        auto start = chrono::steady_clock::now();
+        checksum = 0;
+        for (const auto &p : points)
+            checksum += reference ? noise.reference_turb(p) : noise.turb(p);
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+
+    double reference_sum, simd_sum;
+    auto reference_time = time_turb(true, reference_sum);
+    auto simd_time = time_turb(false, simd_sum);
+
+    double max_error = 0;
+    for (const auto &p : points)
+        max_error = ffmax(max_error, fabs(noise.turb(p) - noise.reference_turb(p)));
+
+    cout << "turb reference: " << count / reference_time / 1e6 << " M lookups/s\n"
+         << "turb simd:      " << count / simd_time / 1e6 << " M lookups/s\n"
+         << "max abs error:  " << max_error << " (checksums " << reference_sum << ", " << simd_sum << ")\n";
+}
+
+// Compares the image_texture layouts on earthmap.jpg upscaled 4x (so the
+// float pyramid no longer fits in cache): memory, bc1 error at level 0, and
+// lookup rate for random uv, for clustered lookups in random order (what
+// incoherent secondary rays hitting one surface produce) and for scanlines.
+void texture_benchmark()
+{
+    int sx, sy, nn;
+    unsigned char *source = stbi_load("earthmap.jpg", &sx, &sy, &nn, 3);
+    if (source == nullptr)
+        return;
+    const int nx = 4 * sx, ny = 4 * sy;
+    auto load = [&](texture_format format) {
+        auto pixels = static_cast<unsigned char *>(malloc(size_t(3) * nx * ny));
+        stbir_resize_uint8(source, sx, sy, 0, pixels, nx, ny, 0, 3);
+        return make_shared<image_texture>(pixels, nx, ny, format);
+    };
+    shared_ptr<image_texture> textures[] = {load(texture_format::rgb_float),
+                                            load(texture_format::rgb_float_tiled),
+                                            load(texture_format::bc1)};
+    const char *names[] = {"row-major", "z-order", "bc1"};
+    stbi_image_free(source);
+
+    const int count = 1 << 22;
+    vector<vec3> random_uvs(count), clustered_uvs(count), scanline_uvs(count);
+    for (int k = 0; k < count; k++)
+    {
+        random_uvs[k] = vec3(random_double(), random_double(), 0);
+        scanline_uvs[k] = vec3((k % nx + 0.5) / nx, 1 - (k / nx % ny + 0.5) / ny, 0);
+    }
+    for (int k = 0; k < count; k += 256)
+    {
+        auto center = vec3(random_double(), random_double(), 0);
+        for (int m = k; m < k + 256; m++)
+            clustered_uvs[m] = center + vec3(random_double(-64, 64) / nx, random_double(-64, 64) / ny, 0);
+    }
+
+    double squared_error = 0;
+    for (int j = 0; j < ny; j += 4)
+        for (int i = 0; i < nx; i += 4)
+        {
+            auto u = (i + 0.5) / nx, v = 1 - (j + 0.5) / ny;
+            auto d = textures[0]->value(u, v, vec3()) - textures[2]->value(u, v, vec3());
+            squared_error += dot(d, d) / 3;
+        }
+
+    // Best of three runs.
+    auto time_lookups = [&](const image_texture &tex, const vector<vec3> &uvs, double &checksum) {
+        double best = 0;
+        for (int run = 0; run < 3; run++)
+        {
+            auto start = chrono::steady_clock::now();
+            checksum = 0;
+            for (const auto &uv : uvs)
+                checksum += tex.value(uv.x(), uv.y(), vec3()).x();
+            best = ffmax(best, count / chrono::duration<double>(chrono::steady_clock::now() - start).count() / 1e6);
+        }
+        return best;
+    };
+
+    cout << nx << 'x' << ny << ", bc1 rmse " << sqrt(squared_error / (double(nx / 4) * (ny / 4))) << "\n"
+         << "layout        memory KB   random  clustered  scanline (M lookups/s)\n";
+    for (int t = 0; t < 3; t++)
+    {
+        double sums[3];
+        auto random_rate = time_lookups(*textures[t], random_uvs, sums[0]);
+        auto clustered_rate = time_lookups(*textures[t], clustered_uvs, sums[1]);
+        auto scanline_rate = time_lookups(*textures[t], scanline_uvs, sums[2]);
+        cout << names[t] << "\t" << textures[t]->memory_bytes() / 1024 << "\t" << random_rate << "\t"
+             << clustered_rate << "\t" << scanline_rate << "\t(checksums " << sums[0] << ", " << sums[1]
+             << ", " << sums[2] << ")\n";
+    }
+}
+
+// Checks heterogeneous_medium's delta tracking: for random rays through a
+// constant grid and through the deep_volume noise at a tenth of its density
+// (so that rays still get through), the fraction of flights that escape must
+// match exp(-optical depth), integrated by ray marching the same trilinear
+// density. Deviations are in standard errors of the escape fraction; returns
+// false if one exceeds 5.
+bool volume_check()
+{
+    aabb bounds(vec3(-1, -1, -1), vec3(1, 1, 1));
+    auto constant = make_shared<density_grid>(8, 8, 8, bounds);
+    std::fill(constant->values.begin(), constant->values.end(), 0.75f);
+    perlin noise(7);
+    const pair<const char *, shared_ptr<density_grid>> grids[] = {
+        {"constant 0.75", constant}, {"deep_volume noise / 10", density_grid::from_perlin(noise, bounds, 64, 4, 4)}};
+
+    const int ray_count = 100, flights = 4000, steps = 4000;
+    bool passed = true;
+    for (const auto &g : grids)
+    {
+        heterogeneous_medium medium(g.second, make_shared<constant_texture>(vec3(1, 1, 1)));
+        double tracked_sum = 0, marched_sum = 0, worst = 0;
+        for (int k = 0; k < ray_count; k++)
+        {
+            auto origin = 3 * random_unit_vector();
+            ray r(origin, vec3::random(-0.9, 0.9) - origin);
+
+            // Clip to the grid and march the optical depth.
+            double t0 = 0, t1 = infinity;
+            for (int a = 0; a < 3; a++)
+            {
+                auto ta = (bounds.min()[a] - r.origin()[a]) / r.direction()[a];
+                auto tb = (bounds.max()[a] - r.origin()[a]) / r.direction()[a];
+                t0 = ffmax(t0, ffmin(ta, tb));
+                t1 = ffmin(t1, ffmax(ta, tb));
+            }
+            double depth = 0, dt = (t1 - t0) / steps;
+            for (int i = 0; i < steps; i++)
+                depth += g.second->density(r.at(t0 + (i + 0.5) * dt)) * dt * r.direction().length();
+            auto marched = exp(-depth);
+
+            int escaped = 0;
+            for (int f = 0; f < flights; f++)
+            {
+                hit_record rec;
+                escaped += !medium.hit(r, 0.001, infinity, rec);
+            }
+            auto tracked = double(escaped) / flights;
+            auto error = sqrt(ffmax(marched * (1 - marched), 1e-4) / flights);
+            worst = ffmax(worst, fabs(tracked - marched) / error);
+            tracked_sum += tracked;
+            marched_sum += marched;
+        }
+        cout << g.first << ": mean escape " << tracked_sum / ray_count << " tracked, " << marched_sum / ray_count
+             << " marched, worst ray " << worst << " standard errors\n";
+        passed = passed && worst < 5;
+    }
+    cout << (passed ? "volume check passed\n" : "volume check FAILED\n");
+    return passed;
+}
+
+// Set by --tile-budget: scenes page image textures in from tiled files
+// instead of keeping them decoded in memory.
+bool out_of_core_textures = false;
+
+// Set by --bake N: procedural textures on spheres are baked into 2N x N uv
+// images at scene load.
+int bake_resolution = 0;
+
+shared_ptr<texture> scene_image(const string &path)
 {
-    int nx, ny, nn;
-    unsigned char *texture_data = stbi_load("earthmap.jpg", &nx, &ny, &nn, 0);
+    if (out_of_core_textures)
+        return texture_cache::instance().get_tiled(path);
+    return texture_cache::instance().get(path);
+}
 
+hittable_list earth()
+{
     auto earth_surface =
-        make_shared<lambertian>(make_shared<image_texture>(texture_data, nx, ny));
+        make_shared<lambertian>(scene_image("earthmap.jpg"));
     auto globe = make_shared<sphere>(vec3(0, 0, 0), 2, earth_surface);
 
     return hittable_list(globe);
@@ -49,9 +386,12 @@ hittable_list earth()
 
 hittable_list final_scene()
 {
+    if (!out_of_core_textures)
+        texture_cache::instance().prefetch("earthmap.jpg");
+
     hittable_list boxes1;
-    auto ground =
-        make_shared<lambertian>(make_shared<constant_texture>(vec3(0.48, 0.83, 0.53)));
+    auto ground = named("ground",
+                        make_shared<lambertian>(make_shared<constant_texture>(vec3(0.48, 0.83, 0.53))));
 
     const int boxes_per_side = 20;
     for (int i = 0; i < boxes_per_side; i++)
@@ -72,71 +412,503 @@ hittable_list final_scene()
 
     hittable_list objects;
 
-    objects.add(make_shared<bvh_node>(boxes1, 0, 1));
+    objects.add(tag("ground boxes", make_shared<bvh_node>(boxes1, 0, 1)));
 
-    auto light = make_shared<diffuse_light>(make_shared<constant_texture>(vec3(12, 12, 12)));
-    objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+    auto light = named("light", make_shared<diffuse_light>(make_shared<constant_texture>(vec3(12, 12, 12))));
+    objects.add(tag("light", make_shared<xz_rect>(123, 423, 147, 412, 554, light)));
 
     auto center1 = vec3(400, 400, 200);
     auto center2 = center1 + vec3(30, 0, 0);
-    auto moving_sphere_material =
-        make_shared<lambertian>(make_shared<constant_texture>(vec3(0.7, 0.3, 0.1)));
-    objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
-
-    objects.add(make_shared<sphere>(vec3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-    objects.add(make_shared<sphere>(
-        vec3(0, 150, 145), 50, make_shared<metal>(vec3(0.8, 0.8, 0.9), 10.0)));
-
-    auto boundary = make_shared<sphere>(vec3(360, 150, 145), 70, make_shared<dielectric>(1.5));
-    objects.add(boundary);
-    objects.add(make_shared<constant_medium>(
-        boundary, 0.1, make_shared<constant_texture>(vec3(0.2, 0.4, 0.9))));
+    auto moving_sphere_material = named("moving sphere",
+        make_shared<lambertian>(make_shared<constant_texture>(vec3(0.7, 0.3, 0.1))));
+    objects.add(tag("moving sphere",
+                    make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material)));
+
+    objects.add(tag("glass sphere",
+                    make_shared<sphere>(vec3(260, 150, 45), 50, named("glass", make_shared<dielectric>(1.5)))));
+    objects.add(tag("metal sphere", make_shared<sphere>(
+        vec3(0, 150, 145), 50, named("metal", make_shared<metal>(vec3(0.8, 0.8, 0.9), 10.0)))));
+
+    auto boundary =
+        make_shared<sphere>(vec3(360, 150, 145), 70, named("fog ball glass", make_shared<dielectric>(1.5)));
+    objects.add(tag("fog ball glass", boundary));
+    auto fog = make_shared<constant_medium>(boundary, 0.1, make_shared<constant_texture>(vec3(0.2, 0.4, 0.9)));
+    cost_attribution::instance().name_material(fog->phase_function->id, "fog ball");
+    objects.add(tag("fog ball", fog));
 
     boundary = make_shared<sphere>(vec3(0, 0, 0), 5000, make_shared<dielectric>(1.5)); //全局
-    objects.add(make_shared<constant_medium>(
-        boundary, .0002, make_shared<constant_texture>(vec3(1, 1, 1))));
+    fog = make_shared<constant_medium>(boundary, .0002, make_shared<constant_texture>(vec3(1, 1, 1)));
+    cost_attribution::instance().name_material(fog->phase_function->id, "global fog");
+    objects.add(tag("global fog", fog));
 
-    int nx, ny, nn;
-    auto tex_data = stbi_load("earthmap.jpg", &nx, &ny, &nn, 0);
-    auto emat = make_shared<lambertian>(make_shared<image_texture>(tex_data, nx, ny));
-    objects.add(make_shared<xy_rect>(100, 500, 100, 300, 400, emat));
+    auto emat = named("earth", make_shared<lambertian>(scene_image("earthmap.jpg")));
+    objects.add(tag("earth", make_shared<xy_rect>(100, 500, 100, 300, 400, emat)));
 
-    auto pertext = make_shared<noise_texture>(0.1);
-    objects.add(make_shared<sphere>(vec3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
+    shared_ptr<texture> pertext = make_shared<noise_texture>(0.1);
+    if (bake_resolution > 0)
+    {
+        auto start = chrono::steady_clock::now();
+        pertext = make_shared<baked_texture>(pertext, 2 * bake_resolution, bake_resolution,
+                                             [](double u, double v) { return vec3(220, 280, 300) + 80 * sphere_point(u, v); });
+        std::cerr << "Baked noise texture in "
+                  << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s\n";
+    }
+    objects.add(tag("marble sphere",
+                    make_shared<sphere>(vec3(220, 280, 300), 80, named("marble", make_shared<lambertian>(pertext)))));
 
     hittable_list boxes2;
-    auto white = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.73, 0.73, 0.73)));
+    auto white = named("white", make_shared<lambertian>(make_shared<constant_texture>(vec3(0.73, 0.73, 0.73))));
     int ns = 1000;
     for (int j = 0; j < ns; j++)
     {
         boxes2.add(make_shared<sphere>(vec3::random(0, 165), 10, white));
     }
 
-    objects.add(make_shared<translate>(
+    objects.add(tag("sphere cluster", make_shared<translate>(
         make_shared<rotate_y>(
             make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
-        vec3(-100, 270, 395)));
+        vec3(-100, 270, 395))));
 
     return objects;
 }
 
-int main()
+// One small tree (a bottom-level BVH) placed count times by random affine
+// instances under a top-level BVH.
+hittable_list instanced_forest(int count)
+{
+    auto bark = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.4, 0.25, 0.1)));
+    auto leaves = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.2, 0.5, 0.15)));
+    hittable_list tree_parts;
+    tree_parts.add(make_shared<box>(vec3(-2, 0, -2), vec3(2, 20, 2), bark));
+    tree_parts.add(make_shared<sphere>(vec3(0, 25, 0), 10, leaves));
+    tree_parts.add(make_shared<sphere>(vec3(0, 36, 0), 7, leaves));
+    tree_parts.add(make_shared<sphere>(vec3(-5, 28, 4), 6, leaves));
+    shared_ptr<hittable> tree = make_shared<bvh_node>(tree_parts, 0, 1);
+
+    hittable_list forest;
+    for (int k = 0; k < count; k++)
+    {
+        auto xf = affine::translation(vec3(random_double(-1000, 1500), 0, random_double(-500, 3000))) *
+                  affine::rotation(vec3(0, 1, 0), random_double(0, 360)) *
+                  affine::rotation(vec3(1, 0, 0), random_double(-10, 10)) *
+                  affine::scaling(vec3(1, random_double(0.8, 1.5), 1) * random_double(0.8, 2));
+        forest.add(make_shared<instance>(tree, xf));
+    }
+    std::cerr << count << " instances: " << count * sizeof(instance) / 1024 << " KB of instance records\n";
+
+    hittable_list objects;
+    objects.add(make_shared<bvh_node>(forest, 0, 1));
+    auto ground = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.48, 0.83, 0.53)));
+    objects.add(make_shared<xz_rect>(-5000, 5000, -5000, 5000, 0, ground));
+    auto light = make_shared<diffuse_light>(make_shared<constant_texture>(vec3(7, 7, 7)));
+    objects.add(make_shared<xz_rect>(-1000, 1500, -500, 3000, 1500, light));
+    return objects;
+}
+
+hittable_list cornell_box()
+{
+    hittable_list objects;
+
+    auto red = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.65, 0.05, 0.05)));
+    auto white = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.73, 0.73, 0.73)));
+    auto green = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.12, 0.45, 0.15)));
+    auto light = make_shared<diffuse_light>(make_shared<constant_texture>(vec3(15, 15, 15)));
+
+    objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
+    objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
+
+    shared_ptr<hittable> box1 = make_shared<box>(vec3(0, 0, 0), vec3(165, 330, 165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+    objects.add(box1);
+
+    shared_ptr<hittable> box2 = make_shared<box>(vec3(0, 0, 0), vec3(165, 165, 165), white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+    objects.add(box2);
+
+    return objects;
+}
+
+// count small spheres with random materials on a square grid, on a huge
+// ground sphere, in one BVH.
+hittable_list random_sphere_field(int count)
+{
+    hittable_list objects;
+    auto ground = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.5, 0.5, 0.5)));
+    objects.add(make_shared<sphere>(vec3(0, -1000, 0), 1000, ground));
+
+    hittable_list field;
+    int side = int(ceil(sqrt(double(count))));
+    for (int k = 0; k < count; k++)
+    {
+        vec3 center((k % side - side / 2) + 0.9 * random_double(), 0.2,
+                    (k / side - side / 2) + 0.9 * random_double());
+        auto choose_mat = random_double();
+        shared_ptr<material> mat;
+        if (choose_mat < 0.8)
+            mat = make_shared<lambertian>(make_shared<constant_texture>(vec3::random() * vec3::random()));
+        else if (choose_mat < 0.95)
+            mat = make_shared<metal>(vec3::random(.5, 1), random_double(0, .5));
+        else
+            mat = make_shared<dielectric>(1.5);
+        field.add(make_shared<sphere>(center, 0.2, mat));
+    }
+    objects.add(make_shared<bvh_node>(field, 0, 1));
+    return objects;
+}
+
+// An optically thick noise cloud in a unit box, lit from above.
+hittable_list deep_volume()
+{
+    hittable_list objects;
+    perlin noise(7);
+    aabb bounds(vec3(-1, -1, -1), vec3(1, 1, 1));
+    auto grid = density_grid::from_perlin(noise, bounds, 64, 4, 40);
+    objects.add(make_shared<heterogeneous_medium>(grid, make_shared<constant_texture>(vec3(0.9, 0.9, 0.9))));
+
+    auto light = make_shared<diffuse_light>(make_shared<constant_texture>(vec3(6, 6, 6)));
+    objects.add(make_shared<xz_rect>(-2, 2, -2, 2, 3, light));
+    auto ground = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.4, 0.4, 0.4)));
+    objects.add(make_shared<xz_rect>(-20, 20, -20, 20, -1.01, ground));
+    return objects;
+}
+
+// A scene and the view it is rendered from.
+struct scene_setup
+{
+    string name;
+    hittable_list (*build)();
+    vec3 lookfrom, lookat;
+    double vfov;
+    vec3 background;
+};
+
+// Peak resident set size of the process so far, in KB.
+long long peak_rss_kb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#endif
+}
+
+// Renders the standard scene set at a fixed resolution, spp and seed, writes
+// bench-<scene>.ppm files and prints per-scene timings as JSON on stdout.
+// The scene builders and BVH splits are reseeded per scene, so each scene is
+// identical whatever ran before it. Peak RSS is the process-wide peak so far.
+// Phases: "load" is the scene builder, including any BVHs it builds itself;
+// "flatten" is flatten_scene with the BVHs it rebuilds (0 with --no-flatten);
+// "scene_root" is the top-level BVH over the world's objects.
+void render_benchmark(int spp, uint32_t seed, bool flatten)
+{
+    const int image_width = 256;
+    const int image_height = 256;
+    const int max_depth = 10;
+
+    const scene_setup scenes[] = {
+        {"final_scene", final_scene, vec3(278, 278, -800), vec3(278, 278, 0), 40, vec3(0, 0, 0)},
+        {"earth", earth, vec3(13, 2, 3), vec3(0, 0, 0), 20, vec3(0.7, 0.8, 1.0)},
+        {"cornell_box", cornell_box, vec3(278, 278, -800), vec3(278, 278, 0), 40, vec3(0, 0, 0)},
+        {"sphere_field_100k", [] { return random_sphere_field(100000); }, vec3(13, 2, 3), vec3(0, 0, 0), 20,
+         vec3(0.7, 0.8, 1.0)},
+        {"deep_volume", deep_volume, vec3(4, 2, -4), vec3(0, 0, 0), 40, vec3(0.1, 0.1, 0.15)},
+    };
+
+    cout << "{\n  \"width\": " << image_width << ", \"height\": " << image_height << ", \"spp\": " << spp
+         << ", \"seed\": " << seed << ", \"threads\": " << max(thread::hardware_concurrency(), 1u)
+         << ",\n  \"scenes\": [\n";
+    for (size_t n = 0; n < sizeof(scenes) / sizeof(scenes[0]); n++)
+    {
+        const auto &scene = scenes[n];
+        std::cerr << "Benchmarking " << scene.name << "\n";
+        auto seconds_since = [](chrono::steady_clock::time_point t) {
+            return chrono::duration<double>(chrono::steady_clock::now() - t).count();
+        };
+
+        seed_random(seed);
+        srand(seed);
+        auto start = chrono::steady_clock::now();
+        auto world = scene.build();
+        auto load_time = seconds_since(start);
+
+        auto phase = chrono::steady_clock::now();
+        if (flatten)
+            world = flatten_scene(world, 0.0, 1.0);
+        auto flatten_time = seconds_since(phase);
+
+        phase = chrono::steady_clock::now();
+        scene_root root(world, 0.0, 1.0);
+        auto root_time = seconds_since(phase);
+
+        camera cam(scene.lookfrom, scene.lookat, vec3(0, 1, 0), scene.vfov, double(image_width) / image_height,
+                   0.0, 10.0, 0.0, 1.0);
+        cam.pixel_spread = 2 * tan(degrees_to_radians(scene.vfov) / 2) / image_height;
+
+        phase = chrono::steady_clock::now();
+        framebuffer fb(image_width, image_height);
+        atomic<long long> rays(0);
+        parallel_for(0, image_height, [&](int j) {
+            sampler smp(seed);
+            auto before = rays_traced;
+            for (int i = 0; i < image_width; ++i)
+                render_pixel(i, j, spp, &smp, cam, scene.background, root, image_width, image_height,
+                             max_depth, &fb);
+            rays += rays_traced - before;
+        });
+        auto trace_time = seconds_since(phase);
+
+        phase = chrono::steady_clock::now();
+        {
+            ofstream out("bench-" + scene.name + ".ppm");
+            out << "P3\n"
+                << image_width << " " << image_height << "\n255\n";
+            for (int j = image_height - 1; j >= 0; --j)
+                for (int i = 0; i < image_width; ++i)
+                    fb.color[fb.index(i, j)].write_color(out, 1);
+        }
+        auto output_time = seconds_since(phase);
+        auto wall_time = seconds_since(start);
+
+        cout << "    {\"name\": \"" << scene.name << "\", \"wall_s\": " << wall_time
+             << ", \"rays\": " << rays << ", \"rays_per_s\": " << rays / trace_time
+             << ", \"phases_s\": {\"load\": " << load_time << ", \"flatten\": " << flatten_time
+             << ", \"scene_root\": " << root_time
+             << ", \"trace\": " << trace_time << ", \"output\": " << output_time
+             << "}, \"peak_rss_kb\": " << peak_rss_kb() << "}"
+             << (n + 1 < sizeof(scenes) / sizeof(scenes[0]) ? "," : "") << "\n";
+    }
+    cout << "  ]\n}\n";
+}
+
+// Traversal-cost heatmap of the camera's view, written to <prefix>.ppm and
+// <prefix>.exr. By default one ray through each pixel centre is traced to its
+// first hit; with whole_path, full paths are traced and the cost averaged over
+// spp samples. The counts come from the TRACING_STATS counters. Returns false
+// when either file could not be written.
+bool render_heatmap(camera &cam, const vec3 &background, const scene_root &world, int image_width,
+                      int image_height, int max_depth, int spp, bool whole_path, const string &prefix)
+{
+    cost_map map(image_width, image_height);
+    atomic<int> rows_done(0);
+    parallel_for(0, image_height, [&](int j) {
+        for (int i = 0; i < image_width; ++i)
+        {
+            long long nodes_before, prims_before, nodes_after, prims_after;
+            cost_map::snapshot(nodes_before, prims_before);
+            if (whole_path)
+                render_pixel(i, j, spp, nullptr, cam, background, world, image_width, image_height, max_depth);
+            else
+            {
+                hit_record rec;
+                world.hit(cam.get_ray((i + 0.5) / image_width, (j + 0.5) / image_height), 0.001, infinity, rec);
+            }
+            cost_map::snapshot(nodes_after, prims_after);
+
+            auto samples = whole_path ? spp : 1;
+            map.nodes[map.index(i, j)] = float(nodes_after - nodes_before) / samples;
+            map.prims[map.index(i, j)] = float(prims_after - prims_before) / samples;
+        }
+        std::cerr << "\rHeatmap rows remaining: " << image_height - ++rows_done << ' ' << std::flush;
+    });
+
+    if (map.write(prefix))
+        return true;
+    std::cerr << "\nCould not write " << prefix << ".ppm/.exr\n";
+    return false;
+}
+
+int main(int argc, char **argv)
 {
     time_t nowtim = time(0);
 
+    bool use_sobol = true;
+    bool convergence = false;
+    bool denoising = false;
+    bool noise_bench = false;
+    bool texture_bench = false;
+    bool volume_checking = false;
+    bool flatten = true;
+    int forest = 0;
+    bool bench = false;
+    bool heatmap = false;
+    bool heatmap_path = false;
+    bool attribution = false;
+    bool bvh_report = false;
+    bool memory_report = false;
+    uint32_t seed = 1;
+    int samples_per_pixel = 10000; // interactive default; other modes pick their own unless --spp is given
+    bool spp_given = false;
+    string aov_path;
+    string timeline_path;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (!strcmp(argv[a], "--random"))
+            use_sobol = false;
+        else if (!strcmp(argv[a], "--convergence"))
+            convergence = true;
+        else if (!strcmp(argv[a], "--denoise"))
+            denoising = true;
+        else if (!strcmp(argv[a], "--noise-bench"))
+            noise_bench = true;
+        else if (!strcmp(argv[a], "--texture-bench"))
+            texture_bench = true;
+        else if (!strcmp(argv[a], "--volume-check"))
+            volume_checking = true;
+        else if (!strcmp(argv[a], "--no-flatten"))
+            flatten = false;
+        else if (!strcmp(argv[a], "--forest") && a + 1 < argc)
+            forest = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--bench"))
+            bench = true;
+        else if (!strcmp(argv[a], "--heatmap"))
+            heatmap = true;
+        else if (!strcmp(argv[a], "--heatmap-path"))
+            heatmap = heatmap_path = true;
+        else if (!strcmp(argv[a], "--bvh-report"))
+            bvh_report = true;
+        else if (!strcmp(argv[a], "--memory-report"))
+            memory_report = true;
+        else if (!strcmp(argv[a], "--attribution"))
+            attribution = true;
+        else if (!strcmp(argv[a], "--seed") && a + 1 < argc)
+            seed = uint32_t(atoi(argv[++a]));
+        else if (!strcmp(argv[a], "--spp") && a + 1 < argc)
+        {
+            samples_per_pixel = atoi(argv[++a]);
+            spp_given = true;
+        }
+        else if (!strcmp(argv[a], "--timeline") && a + 1 < argc)
+            timeline_path = argv[++a];
+        else if (!strcmp(argv[a], "--aov") && a + 1 < argc)
+            aov_path = argv[++a];
+        else if (!strcmp(argv[a], "--bake") && a + 1 < argc)
+            bake_resolution = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--tile-budget") && a + 1 < argc)
+        {
+            out_of_core_textures = true;
+            tile_cache::instance().set_budget(size_t(atof(argv[++a]) * 1024 * 1024));
+        }
+    }
+
+    // Written on every return below, the early benchmark and report modes included.
+    timeline_output timeline_file(timeline_path);
+
+    if (noise_bench)
+    {
+        noise_benchmark();
+        return 0;
+    }
+
+    if (texture_bench)
+    {
+        texture_benchmark();
+        return 0;
+    }
+
+    if (volume_checking)
+        return volume_check() ? 0 : 1;
+
+    if (bench)
+    {
+        render_benchmark(spp_given ? samples_per_pixel : 16, seed, flatten);
+        return 0;
+    }
+
+    const string image_path = "C:\\Users\\jnjnjnzhang\\Documents\\GitHub\\RayTracing\\Tracing\\image5-0.ppm";
     ofstream ou;
-    ou.open("C:\\Users\\jnjnjnzhang\\Documents\\GitHub\\RayTracing\\Tracing\\image5-0.ppm");
+    ou.open(image_path);
     //ou.open(strho);
     const int image_width = 1000;
     const int image_height = 1000;
-    const int samples_per_pixel = 10000;
     const int max_depth = 10;
     const vec3 background(0, 0, 0);
 
     ou << "P3\n"
        << image_width << " " << image_height << "\n255\n";
 
-    auto world = final_scene();
+    hittable_list world;
+    {
+        timeline_scope scope("build scene", "load");
+        world = forest > 0 ? instanced_forest(forest) : final_scene();
+    }
+    if (flatten)
+    {
+        timeline_scope scope("flatten and build bvh", "load");
+        world = flatten_scene(world, 0.0, 1.0, &std::cerr);
+    }
+    texture_cache::instance().report(std::cerr);
+
+    if (bvh_report)
+    {
+        // Each top-level BVH, then the scene root's BVH over the top-level objects.
+        vector<pair<string, shared_ptr<hittable>>> trees;
+        for (size_t k = 0; k < world.objects.size(); k++)
+        {
+            auto object = world.objects[k];
+            string name = "#" + to_string(k);
+            if (typeid(*object) == typeid(tagged))
+            {
+                name = static_cast<const tagged &>(*object).name;
+                object = static_cast<const tagged &>(*object).object;
+            }
+            trees.push_back({name, object});
+        }
+        scene_root root(world, 0.0, 1.0);
+        if (root.bounded)
+            trees.push_back({"scene root", root.bounded});
+
+        for (const auto &t : trees)
+        {
+            const auto &name = t.first;
+            if (typeid(*t.second) != typeid(bvh_node))
+                continue;
+
+            const auto &tree = static_cast<const bvh_node &>(*t.second);
+            auto cost = bvh_ray_cost::measure(tree, 100000);
+            std::cerr << "BVH " << name << ":\n";
+            bvh_quality::analyze(tree).report(std::cerr);
+            std::cerr << "  measured per random ray: " << cost.nodes << " nodes, " << cost.primitives
+                      << " primitives, " << cost.hit_rate * 100 << "% hit\n";
+        }
+        return 0;
+    }
+
+    if (memory_report)
+    {
+        scene_memory memory;
+        memory.add_scene(world);
+        memory.report(std::cerr);
+        std::cerr << "Peak resident set: " << peak_rss_kb() << " KB\n";
+        return 0;
+    }
+
+    if (attribution)
+    {
+        // Untagged top-level objects are named by class and position.
+        for (size_t k = 0; k < world.objects.size(); k++)
+            if (typeid(*world.objects[k]) != typeid(tagged))
+                world.objects[k] = tag("#" + to_string(k) + " " + type_label(typeid(*world.objects[k])),
+                                       world.objects[k]);
+        cost_attribution::instance().enabled = true;
+    }
+
+    // Huge and unbounded objects (the global fog) are kept out of the BVH.
+    shared_ptr<scene_root> root;
+    {
+        timeline_scope scope("build scene root", "load");
+        root = make_shared<scene_root>(world, 0.0, 1.0);
+    }
+    root->report(std::cerr);
 
     const auto aspect_ratio = double(image_width) / image_height;
 
@@ -148,24 +920,81 @@ int main()
     auto vfov = 40.0;
 
     camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
+    cam.pixel_spread = 2 * tan(degrees_to_radians(vfov) / 2) / image_height;
 
-    for (int j = 50 - 1; j >= 0; --j)
+    if (convergence)
     {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i)
-        {
-            vec3 color(0, 0, 0);
-            for (int s = 0; s < samples_per_pixel; ++s)
-            {
-                auto u = (i + random_double()) / image_width;
-                auto v = (j + random_double()) / image_height;
-                ray r = cam.get_ray(u, v);
-                color += ray_color(r, background, world, max_depth);
-            }
-            color.write_color(ou, samples_per_pixel);
-        }
+        convergence_study(cam, background, *root, image_width, image_height, max_depth);
+        return 0;
+    }
+
+    if (heatmap)
+    {
+#ifdef TRACING_STATS
+        // The whole frame, not just the rendered rows; paths default to 4 spp.
+        auto prefix = image_path.substr(0, image_path.rfind('.')) + "-heatmap";
+        if (!render_heatmap(cam, background, *root, image_width, image_height, max_depth,
+                            spp_given ? samples_per_pixel : 4, heatmap_path, prefix))
+            return 1;
+        std::cerr << "\nWrote " << prefix << ".ppm and " << prefix << ".exr\n";
+        return 0;
+#else
+        std::cerr << "--heatmap needs a build with -DTRACING_STATS\n";
+        return 1;
+#endif
+    }
+
+    const int rows = 50;
+    framebuffer fb(image_width, rows);
+    atomic<int> rows_done(0);
+    {
+        timeline_scope scope("render", "render");
+        parallel_for(0, rows, [&](int j) {
+            timeline_scope row("row", "render", j);
+            sampler smp;
+            for (int i = 0; i < image_width; ++i)
+                render_pixel(i, j, samples_per_pixel, use_sobol ? &smp : nullptr, cam, background, *root,
+                             image_width, image_height, max_depth, &fb);
+            std::cerr << "\rScanlines remaining: " << rows - ++rows_done << ' ' << std::flush;
+        });
     }
 
+    if (!aov_path.empty())
+    {
+        timeline_scope scope("write aovs", "output", aov_path);
+        if (!fb.write_aovs(aov_path))
+            std::cerr << "\nCould not write " << aov_path << "\n";
+    }
+
+    if (denoising)
+    {
+        timeline_scope scope("denoise", "output");
+        denoise(fb);
+    }
+
+    {
+        timeline_scope scope("write image", "output", image_path);
+        for (int j = rows - 1; j >= 0; --j)
+            for (int i = 0; i < image_width; ++i)
+                fb.color[fb.index(i, j)].write_color(ou, 1);
+    }
+
+    if (out_of_core_textures)
+        tile_cache::instance().report(std::cerr);
+    if (attribution)
+    {
+        std::cerr << "\n";
+        cost_attribution::instance().report(std::cerr);
+    }
+#ifdef TRACING_STATS
+    {
+        auto stats = render_stats::total();
+        std::cerr << "\n";
+        stats.print_table(std::cerr);
+        ofstream json(image_path.substr(0, image_path.rfind('.')) + "-stats.json");
+        stats.write_json(json);
+    }
+#endif
     std::cerr << "\nDone.\n";
     cout << time(0) - nowtim << endl;
 }
@@ -1,6 +1,8 @@
 #ifndef VEC_H
 #define VEC_H
 
+#include "sampler.h"
+#include <atomic>
 #include <cmath>
 #include <iostream>
 #include <stdlib.h>
@@ -17,10 +19,46 @@ inline double clamp(double x, double min, double max)
         return max;
     return x;
 }
+inline uint64_t &random_state()
+{
+    // Per-thread splitmix64 stream, so parallel rendering neither contends on
+    // rand()'s lock nor repeats one sequence on every thread. The first thread
+    // to draw (the main thread, building the scene) always gets stream 0.
+    static std::atomic<uint64_t> next_stream(0);
+    thread_local uint64_t state = 0x853c49e6748fea9bull * (next_stream++ + 1);
+    return state;
+}
+
+// Restarts the calling thread's stream at the start of stream `stream`.
+inline void seed_random(uint64_t stream)
+{
+    random_state() = 0x853c49e6748fea9bull * (stream + 1);
+}
+
+inline double random_uniform()
+{
+    uint64_t z = (random_state() += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
 inline double random_double()
 {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    if (active_sampler)
+        return active_sampler->get_1d();
+    return random_uniform();
+}
+
+inline void random_double2(double &a, double &b)
+{
+    // Returns a 2D sample in [0,1)^2, stratified as a pair when a sampler is active.
+    if (active_sampler)
+        return active_sampler->get_2d(a, b);
+    a = random_uniform();
+    b = random_uniform();
 }
 
 inline double random_double(double min, double max)
@@ -165,21 +203,20 @@ inline vec3 unit_vector(vec3 v)
 
 vec3 random_unit_vector()
 {
-    auto a = random_double(0, 2 * pi);
-    auto z = random_double(-1, 1);
+    double s, t;
+    random_double2(s, t);
+    auto a = 2 * pi * s;
+    auto z = 2 * t - 1;
     auto r = sqrt(1 - z * z);
     return vec3(r * cos(a), r * sin(a), z);
 }
 
 vec3 random_in_unit_sphere()
 {
-    while (true)
-    {
-        auto p = vec3::random(-1, 1);
-        if (p.length_squared() >= 1)
-            continue;
-        return p;
-    }
+    // Direct mapping instead of rejection, so every call consumes the same
+    // number of sample dimensions.
+    auto r = cbrt(random_double());
+    return r * random_unit_vector();
 }
 
 vec3 random_in_hemisphere(const vec3 &normal)
@@ -206,13 +243,11 @@ vec3 refract(const vec3 &uv, const vec3 &n, double etai_over_etat)
 
 vec3 random_in_unit_disk()
 {
-    while (true)
-    {
-        auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-        if (p.length_squared() >= 1)
-            continue;
-        return p;
-    }
+    double s, t;
+    random_double2(s, t);
+    auto r = sqrt(s);
+    auto a = 2 * pi * t;
+    return vec3(r * cos(a), r * sin(a), 0);
 }
 
 #endif
\ No newline at end of file